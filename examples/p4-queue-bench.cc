@@ -0,0 +1,113 @@
+/*
+Command:
+./waf --run "p4-queue-bench --packets=1000000 --ports=8 --priorities=8"
+
+Microbenchmark of the queue locking policies used by the P4 switch model.
+It prints the number of operations (one push + one pop) per second for:
+    - NSQueueingLogicPriRL with NullLockingPolicy (single ns-3 thread)
+    - NSQueueingLogicPriRL with MutexLockingPolicy (bmv2 style)
+*/
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "ns3/core-module.h"
+#include "ns3/p4-queue-policy.h"
+#include "ns3/p4-queueing-logic.h"
+
+using namespace ns3;
+
+NS_LOG_COMPONENT_DEFINE("P4QueueBench");
+
+using bench_clock = std::chrono::steady_clock;
+
+struct WorkerMapper {
+    size_t operator()(size_t /* queue_id */) const
+    {
+        return 0;
+    }
+};
+
+static void PrintResult(const std::string& name, uint64_t ops, bench_clock::duration elapsed)
+{
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << std::left << std::setw(40) << name << std::right << std::setw(16)
+              << static_cast<uint64_t>(ops / seconds) << " ops/sec" << std::endl;
+}
+
+template <typename Policy>
+struct QueueingLogicBench {
+    using QueueType = NSQueueingLogicPriRL<std::unique_ptr<uint64_t>, WorkerMapper, Policy>;
+
+    QueueingLogicBench(std::string name, uint64_t packets, size_t ports, size_t priorities)
+        : name(name)
+        , packets(packets)
+        , ports(ports)
+        , priorities(priorities)
+        , queue(1, packets, WorkerMapper(), priorities)
+    {
+        // fast enough so that every packet has left at the time of PopAll
+        queue.set_rate_for_all(1000000000);
+    }
+
+    void PushAll()
+    {
+        auto begin = bench_clock::now();
+        for (uint64_t i = 0; i < packets; i++) {
+            queue.push_front(i % ports, i % priorities, std::unique_ptr<uint64_t>(new uint64_t(i)));
+        }
+        elapsed += bench_clock::now() - begin;
+    }
+
+    // as the egress ports of P4Model: every port drains its own queue
+    void PopAll()
+    {
+        size_t priority;
+        std::unique_ptr<uint64_t> item;
+        Time next;
+        auto begin = bench_clock::now();
+        for (size_t port = 0; port < ports; port++) {
+            while (queue.get_queue_next_departure(port, &next)) {
+                queue.pop_back_queue(port, &priority, &item);
+            }
+        }
+        elapsed += bench_clock::now() - begin;
+        PrintResult(name, packets, elapsed);
+    }
+
+    std::string name;
+    uint64_t packets;
+    size_t ports;
+    size_t priorities;
+    QueueType queue;
+    bench_clock::duration elapsed { 0 };
+};
+
+int main(int argc, char* argv[])
+{
+    uint64_t packets = 1000000;
+    size_t ports = 8;
+    size_t priorities = 8;
+
+    CommandLine cmd;
+    cmd.AddValue("packets", "Number of packets pushed and popped per benchmark", packets);
+    cmd.AddValue("ports", "Number of egress ports (logical queues)", ports);
+    cmd.AddValue("priorities", "Number of priority queues per port", priorities);
+    cmd.Parse(argc, argv);
+
+    // NSQueueingLogicPriRL reads the simulation time, so it is run inside events.
+    QueueingLogicBench<NullLockingPolicy> null_bench("NSQueueingLogicPriRL<NullLockingPolicy>",
+        packets, ports, priorities);
+    QueueingLogicBench<MutexLockingPolicy> mutex_bench("NSQueueingLogicPriRL<MutexLockingPolicy>",
+        packets, ports, priorities);
+    Simulator::Schedule(Seconds(0), &QueueingLogicBench<NullLockingPolicy>::PushAll, &null_bench);
+    Simulator::Schedule(Seconds(1), &QueueingLogicBench<NullLockingPolicy>::PopAll, &null_bench);
+    Simulator::Schedule(Seconds(0), &QueueingLogicBench<MutexLockingPolicy>::PushAll, &mutex_bench);
+    Simulator::Schedule(Seconds(1), &QueueingLogicBench<MutexLockingPolicy>::PopAll, &mutex_bench);
+    Simulator::Run();
+    Simulator::Destroy();
+
+    return 0;
+}
@@ -173,7 +173,10 @@ int main(int argc, char* argv[])
     
     // Here we need calculated the congestion, how many packets we want to pass the queue
     uint64_t congestion_bottleneck = 5; // Mbps
-    uint64_t rate_pps = (uint64_t)(congestion_bottleneck * 1024 * 1024 / (pktSize * 8));
+    uint64_t rate_bps = congestion_bottleneck * 1024 * 1024; // egress queues, any packet size
+    uint32_t burst_bytes = 1500; // egress token bucket depth
+    uint64_t rate_pps = rate_bps / (pktSize * 8);
+    // polling period of the switch, the egress token buckets do the shaping
     P4GlobalVar::g_switchBottleNeck = (uint64_t)(1000000 / rate_pps); // pps/us
 
     // The times
@@ -209,26 +212,17 @@ int main(int argc, char* argv[])
     cmd.AddValue("trace_drop", "Trace packet drop by p4[true] or not[false]", P4GlobalVar::ns3_p4_tracing_drop);
     cmd.AddValue("p4src", "the algorithm of the p4-switch, [codel+], [codel++], [codel++v2], [codel_recir], [new_codel],[new_codel_v2], [simple_switch], [simple_codel], [priority_queuing]", p4src);
     cmd.AddValue("pcap", "Trace packet pacp [true] or not[false]", enableTracePcap);
+    cmd.AddValue("scheduling", "Switch scheduling mode, polling[0] or event driven[1]", P4GlobalVar::g_schedulingMode);
+    cmd.AddValue("burst", "Max packets handled by one switch event per stage", P4GlobalVar::g_switchBurstSize);
     cmd.Parse(argc, argv);
 
     // ============================ ns-3 <----> bmv2 ============================
 
     // the p4 simulator(ns-3) connect with BMv2 pipeline (get tracing value, get pkts_ID etc.)
-    //      if the p4 change the headers and strcut, for example "scalars.userMetadata._ns3i_ns3_drop18"
-    //      the "18" maybe change to other number, this will cause the ERROR. 
-    if (p4src == "simple_switch" or p4src == "priority_queuing") {
-        P4GlobalVar::ns3i_drop_1 = "scalars.userMetadata._ns3i_ns3_drop1";
-        P4GlobalVar::ns3i_drop_2 = "scalars.userMetadata._ns3i_ns3_drop1";
-        P4GlobalVar::ns3i_priority_id_1 = "scalars.userMetadata._ns3i_ns3_priority_id2";
-        P4GlobalVar::ns3i_priority_id_2 = "scalars.userMetadata._ns3i_ns3_priority_id2";
-        P4GlobalVar::ns3i_protocol_1 = "scalars.userMetadata._ns3i_protocol3";
-        P4GlobalVar::ns3i_protocol_2 = "scalars.userMetadata._ns3i_protocol3";
-        P4GlobalVar::ns3i_destination_1 = "scalars.userMetadata._ns3i_destination4";
-        P4GlobalVar::ns3i_destination_2 = "scalars.userMetadata._ns3i_destination4";
-        P4GlobalVar::ns3i_pkts_id_1 = "scalars.userMetadata._ns3i_pkts_id5";
-        P4GlobalVar::ns3i_pkts_id_2 = "scalars.userMetadata._ns3i_pkts_id5";
-    }
-    else {
+    //      through the "ns3i" metadata of the P4 program, for example "scalars.userMetadata._ns3i_protocol3".
+    //      Every switch finds these fields by their "_ns3i_" prefix when it loads its program,
+    //      whatever number the compiler appended, so nothing has to be set here.
+    if (p4src != "simple_switch" and p4src != "priority_queuing") {
         std::cout << "Now can only using simple_switch as P4 switch!" << std::endl;
     }
 
@@ -510,7 +504,7 @@ int main(int argc, char* argv[])
                 P4Model* p4_model = p4_net_device->GetP4Model();
 
                 p4_model->set_all_egress_queue_depths(depth_pkts_all);
-                p4_model->set_all_egress_queue_rates(rate_pps); // allocate all resources.
+                p4_model->set_all_egress_queue_rates_bps(rate_bps, burst_bytes); // allocate all resources.
             }
         }
     } else {
@@ -0,0 +1,60 @@
+# Turn the binary trace files of the P4 switches (P4GlobalVar::ns3_p4_tracing_dalay_sim,
+# one p4-trace-switch-<id>.bin per switch) into the csv files of the former tracing:
+#
+#   sim_delay_in_switch_<id>.csv   SimIn,<packet id>,<time>
+#   sim_in_queue_<id>.csv          SimQIn,<packet id>,<time>
+#   sim_out_queue_<id>.csv         SimQOut,<packet id>,<priority>,<time>
+#   sim_delay_out_switch_<id>.csv  SimOut,<packet id>,<priority>,<time>
+#
+# The time is written in ns, as "+<time>ns".
+#
+# Usage: python3 p4-trace-to-csv.py <output dir> <trace file>...
+
+import os
+import struct
+import sys
+
+MAGIC = b"p4trace1"
+RECORD = struct.Struct("=IIqqq")  # event, switch id, time (ns), packet id, priority
+
+EVENTS = {
+    0: ("sim_delay_in_switch", "SimIn", False),
+    1: ("sim_in_queue", "SimQIn", False),
+    2: ("sim_out_queue", "SimQOut", True),
+    3: ("sim_delay_out_switch", "SimOut", True),
+}
+
+
+def convert(path, output_dir, files):
+    with open(path, "rb") as trace:
+        if trace.read(len(MAGIC)) != MAGIC:
+            sys.exit("{}: not a P4 trace file".format(path))
+        while True:
+            data = trace.read(RECORD.size * 4096)
+            if not data:
+                break
+            for event, switch_id, time, packet_id, priority in RECORD.iter_unpack(
+                    data[:len(data) - len(data) % RECORD.size]):
+                name, tag, with_priority = EVENTS[event]
+                key = (name, switch_id)
+                if key not in files:
+                    filename = "{}_{}.csv".format(name, switch_id)
+                    files[key] = open(os.path.join(output_dir, filename), "w")
+                if with_priority:
+                    files[key].write("{},{},{},+{}ns\n".format(tag, packet_id, priority, time))
+                else:
+                    files[key].write("{},{},+{}ns\n".format(tag, packet_id, time))
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("usage: {} <output dir> <trace file>...".format(sys.argv[0]))
+    files = {}
+    for path in sys.argv[2:]:
+        convert(path, sys.argv[1], files)
+    for f in files.values():
+        f.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,7 @@ NS_LOG_COMPONENT_DEFINE("P4GlobalVar");
 NS_OBJECT_ENSURE_REGISTERED(P4GlobalVar);
 
 P4Controller P4GlobalVar::g_p4Controller;
+P4AddressTable P4GlobalVar::g_addressTable;
 
 /*******************************
  *    P4 switch configuration  *
@@ -21,6 +22,8 @@ unsigned int P4GlobalVar::g_populateFlowTableWay =
     RUNTIME_CLI; // LOCAL_CALL/RUNTIME_CLI
 std::string P4GlobalVar::g_p4JsonPath = "";
 int P4GlobalVar::g_switchBottleNeck = 10000;
+unsigned int P4GlobalVar::g_schedulingMode = POLLING_SCHEDULE;
+unsigned int P4GlobalVar::g_switchBurstSize = 1;
 
 std::string P4GlobalVar::g_homePath = "/home/p4/";
 std::string P4GlobalVar::g_ns3RootName = "/";
@@ -65,6 +68,7 @@ std::string P4GlobalVar::ns3i_pkts_id_2 =
     "scalars.userMetadata._ns3i_pkts_id18";
 bool P4GlobalVar::ns3_inner_p4_tracing = false;
 bool P4GlobalVar::ns3_p4_tracing_dalay_sim = false;
+std::string P4GlobalVar::ns3_p4_tracing_dir = "./scratch-data/p4-codel/";
 bool P4GlobalVar::ns3_p4_tracing_dalay_ByteTag = false; // Byte Tag
 bool P4GlobalVar::ns3_p4_tracing_control =
     false; // how the switch control the pkts
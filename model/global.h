@@ -2,6 +2,7 @@
 #define GLOBAL_H
 
 #include "ns3/object.h"
+#include "ns3/p4-address-table.h"
 #include "ns3/p4-controller.h"
 #include <cstring>
 #include <map>
@@ -14,6 +15,10 @@ namespace ns3 {
 #define RUNTIME_CLI 1 // Use runtime CLI to configure the flow table
 #define NS3PIFOTM 2   // Use thrift port to configure the flow table
 
+// Scheduling mode of the P4 switch pipeline (ingress/egress/transmit)
+#define POLLING_SCHEDULE 0      // Timer events poll the buffers periodically
+#define EVENT_DRIVEN_SCHEDULE 1 // Events are scheduled only when there is work
+
 // Network function type
 #define NS3 1         // Normal switch
 #define P4Simulator 0 // P4 switch
@@ -50,6 +55,9 @@ public:
   // Controller
   static P4Controller g_p4Controller;
 
+  // Destination addresses of the packets in all the P4 switches, by index
+  static P4AddressTable g_addressTable;
+
   // Switch configuration info
   static unsigned int g_networkFunc;
   static std::string g_p4MatchTypePath;
@@ -69,9 +77,43 @@ public:
    * The BMv2 is not integrated into ns-3 fully, so the control
    * of the bottleneck needs to be set in BMv2 (by setting the packet scheduling
    * speed of the switch).
+   *
+   * Only used with POLLING_SCHEDULE, where it is the service time of one
+   * packet on one egress port (every port has its own clock), unless a byte
+   * rate is set for all the egress queues (P4Model "EgressRateBps"). In
+   * EVENT_DRIVEN_SCHEDULE the egress departures follow the rates configured
+   * for the egress queues.
+   *
+   * A switch with any stage latency set on its P4Model ("ParserLatency",
+   * "MauStageLatency", "DeparserLatency", "TrafficManagerLatency") ignores
+   * this value for its egress ports: packets cross the stages of that switch
+   * on simulated time, and its slowest stage bounds its throughput.
    */
   static int g_switchBottleNeck;
 
+  /**
+   * @brief How the P4 switches schedule their pipeline work, either
+   * POLLING_SCHEDULE (default) or EVENT_DRIVEN_SCHEDULE.
+   *
+   * With POLLING_SCHEDULE, every switch re-arms its ingress, egress and
+   * transmit timers forever, even when it is idle. With EVENT_DRIVEN_SCHEDULE,
+   * ingress work is scheduled as soon as a packet is received, egress work is
+   * scheduled at the exact next departure time of the egress queues, and an
+   * idle switch schedules no event at all.
+   */
+  static unsigned int g_schedulingMode;
+
+  /**
+   * @brief Maximum number of packets that one ingress, egress or transmit
+   * event of a P4 switch handles (default 1, one packet per event).
+   *
+   * With a burst size N > 1 each event drains up to N eligible packets. With
+   * POLLING_SCHEDULE every packet is still charged its per-packet service
+   * time: the next timer event is delayed by one period per packet handled,
+   * so the throughput is unchanged while the number of events drops.
+   */
+  static unsigned int g_switchBurstSize;
+
   // Configure file path info
   static std::string g_homePath;
   static std::string g_ns3RootName;
@@ -82,7 +124,8 @@ public:
   static std::string g_flowTableDir;
   static std::string g_exampleP4SrcDir;
 
-  // ns-3 and P4 connect name
+  // ns-3 and P4 connect name. A P4Model uses these names when its program
+  // has them, otherwise it finds the fields by their "_ns3i_" prefix.
   static std::string ns3i_drop_1;
   static std::string ns3i_drop_2;
   static std::string ns3i_priority_id_1;
@@ -96,8 +139,9 @@ public:
 
   // Tracing info
   static bool ns3_inner_p4_tracing;
-  static bool ns3_p4_tracing_dalay_sim;
-  static bool ns3_p4_tracing_dalay_ByteTag; // Byte Tag
+  static bool ns3_p4_tracing_dalay_sim; // binary trace file per switch, see P4TraceSink
+  static std::string ns3_p4_tracing_dir;  // where the trace files go
+  static bool ns3_p4_tracing_dalay_ByteTag; // unused, every byte and packet tag now crosses the switch
   static bool ns3_p4_tracing_control; // How the switch controls the packets
   static bool ns3_p4_tracing_drop;    // Packets drop in and out of the switch
 
@@ -1,7 +1,11 @@
 #include "ns3/helper.h"
 #include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
+#include <map>
 #include <math.h>
+#include <sstream>
 #include <vector>
 
 namespace ns3 {
@@ -289,4 +293,173 @@ std::string ParseParam(std::string &input_str, unsigned int bitwidth) {
   return IntToBytes(input_str, bw);
 }
 
+Json::Value ParseP4Json(const std::string &config) {
+  Json::CharReaderBuilder builder;
+  std::istringstream in(config);
+  Json::Value root;
+  std::string errors;
+  if (!Json::parseFromStream(builder, in, &root, &errors)) {
+    return Json::Value();
+  }
+  return root;
+}
+
+// the member key of the JSON object v, null if v is not an object or has
+// no such member.
+static const Json::Value &JsonMember(const Json::Value &v, const char *key) {
+  static const Json::Value null;
+  return v.isObject() && v.isMember(key) ? v[key] : null;
+}
+
+static std::string JsonString(const Json::Value &v) {
+  return v.isString() ? v.asString() : "";
+}
+
+// whether text is a string or a member name anywhere in v.
+static bool JsonContains(const Json::Value &v, const std::string &text) {
+  if (v.isString()) {
+    return v.asString() == text;
+  }
+  if (v.isObject() && v.isMember(text)) {
+    return true;
+  }
+  for (const Json::Value &item : v) {
+    if (JsonContains(item, text)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t CountP4PipelineTables(const Json::Value &config, const std::string &pipeline) {
+  for (const Json::Value &element : JsonMember(config, "pipelines")) {
+    if (JsonString(JsonMember(element, "name")) == pipeline) {
+      return JsonMember(element, "tables").size();
+    }
+  }
+  return 0;
+}
+
+// bytes of every header instance of a bmv2 JSON, except metadata.
+static std::map<std::string, size_t> P4HeaderInstanceBytes(const Json::Value &config) {
+  // bytes of every header type
+  std::map<std::string, size_t> type_bytes;
+  for (const Json::Value &type : JsonMember(config, "header_types")) {
+    const Json::Value &name = JsonMember(type, "name");
+    const Json::Value &max_length = JsonMember(type, "max_length");
+    if (!name.isString()) {
+      continue;
+    }
+    size_t bits = 0;
+    if (max_length.isUInt()) {
+      bits = max_length.asUInt() * 8;
+    } else {
+      // every field is [name, width, signed]
+      for (const Json::Value &field : JsonMember(type, "fields")) {
+        if (field.isArray() && field.size() > 1 && field[1].isUInt()) {
+          bits += field[1].asUInt();
+        }
+      }
+    }
+    type_bytes[name.asString()] = (bits + 7) / 8;
+  }
+
+  // bytes of every header instance, except metadata
+  std::map<std::string, size_t> header_bytes;
+  for (const Json::Value &header : JsonMember(config, "headers")) {
+    const Json::Value &name = JsonMember(header, "name");
+    const Json::Value &type = JsonMember(header, "header_type");
+    if (!name.isString() || !type.isString() || JsonMember(header, "metadata") == true) {
+      continue;
+    }
+    header_bytes[name.asString()] = type_bytes[type.asString()];
+  }
+  return header_bytes;
+}
+
+size_t CountP4DeparserBytes(const Json::Value &config) {
+  std::map<std::string, size_t> header_bytes = P4HeaderInstanceBytes(config);
+  size_t largest = 0;
+  for (const Json::Value &deparser : JsonMember(config, "deparsers")) {
+    size_t bytes = 0;
+    for (const Json::Value &header : JsonMember(deparser, "order")) {
+      auto it = header_bytes.find(JsonString(header));
+      if (it != header_bytes.end()) {
+        bytes += it->second;
+      }
+    }
+    largest = std::max(largest, bytes);
+  }
+  return largest;
+}
+
+size_t CountP4HeaderBytes(const Json::Value &config) {
+  size_t bytes = 0;
+  for (const auto &header : P4HeaderInstanceBytes(config)) {
+    bytes += header.second;
+  }
+  return bytes;
+}
+
+bool P4ProgramReadsPayload(const Json::Value &config) {
+  // checksums and hashes over the payload
+  for (const Json::Value &calculation : JsonMember(config, "calculations")) {
+    for (const Json::Value &item : JsonMember(calculation, "input")) {
+      if (JsonString(JsonMember(item, "type")) == "payload") {
+        return true;
+      }
+    }
+  }
+  // a parser which moves past bytes it does not extract (advance, shift) or
+  // peeks at the bytes ahead (lookahead, in a transition key or an
+  // expression) may go past the headers of the program
+  for (const Json::Value &parser : JsonMember(config, "parsers")) {
+    for (const Json::Value &state : JsonMember(parser, "parse_states")) {
+      for (const Json::Value &parser_op : JsonMember(state, "parser_ops")) {
+        std::string op = JsonString(JsonMember(parser_op, "op"));
+        if (op == "advance" || op == "shift") {
+          return true;
+        }
+      }
+      if (JsonContains(state, "lookahead")) {
+        return true;
+      }
+    }
+  }
+  // the truncate primitive cuts the bytes of the bm packet
+  for (const Json::Value &action : JsonMember(config, "actions")) {
+    for (const Json::Value &primitive : JsonMember(action, "primitives")) {
+      if (JsonString(JsonMember(primitive, "op")) == "truncate") {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// add the "id" and "name" of every object of the JSON array objects.
+static void AddP4ObjectNames(const Json::Value &objects, std::map<int, std::string> *names) {
+  for (const Json::Value &object : objects) {
+    const Json::Value &id = JsonMember(object, "id");
+    const Json::Value &name = JsonMember(object, "name");
+    if (id.isUInt() && name.isString()) {
+      (*names)[id.asInt()] = name.asString();
+    }
+  }
+}
+
+std::map<int, std::string> P4TableNames(const Json::Value &config) {
+  std::map<int, std::string> names;
+  for (const Json::Value &pipeline : JsonMember(config, "pipelines")) {
+    AddP4ObjectNames(JsonMember(pipeline, "tables"), &names);
+  }
+  return names;
+}
+
+std::map<int, std::string> P4ActionNames(const Json::Value &config) {
+  std::map<int, std::string> names;
+  AddP4ObjectNames(JsonMember(config, "actions"), &names);
+  return names;
+}
+
 } // namespace ns3
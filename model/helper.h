@@ -3,6 +3,8 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <json/json.h>
+#include <map>
 #include <string>
 
 namespace ns3 {
@@ -89,5 +91,60 @@ std::string IntToBytes(std::string input_str, int bitwidth);
  */
 std::string ParseParam(std::string &input_str, unsigned int bitwidth);
 
+/**
+ * @brief parse a bmv2 JSON configuration (e.g. Switch::get_config()) once
+ * for the functions below.
+ *
+ * @return Json::Value null if the configuration is not valid JSON
+ */
+Json::Value ParseP4Json(const std::string &config);
+
+/**
+ * @brief count the match-action tables of one pipeline ("ingress" or
+ * "egress") in a bmv2 JSON configuration, by walking the "pipelines"
+ * array. Only the JSON structure is checked, not the table contents.
+ *
+ * @param config the bmv2 JSON configuration, see ParseP4Json
+ * @param pipeline name of the pipeline
+ * @return size_t 0 if the pipeline is not found
+ */
+size_t CountP4PipelineTables(const Json::Value &config, const std::string &pipeline);
+
+/**
+ * @brief bytes of all the headers that the deparser of a bmv2 JSON
+ * configuration may emit (the largest deparser if there are several). A
+ * header with a varbit field counts its "max_length". This bounds what
+ * the deparser adds in front of the payload of a packet.
+ *
+ * @param config the bmv2 JSON configuration, see ParseP4Json
+ * @return size_t 0 if the configuration has no deparser
+ */
+size_t CountP4DeparserBytes(const Json::Value &config);
+
+/**
+ * @brief bytes of all the header instances (not metadata) of a bmv2 JSON
+ * configuration, which bounds the bytes its parser can extract.
+ */
+size_t CountP4HeaderBytes(const Json::Value &config);
+
+/**
+ * @brief whether a bmv2 JSON configuration uses the payload of a packet,
+ * in a calculation (checksum or hash with the payload), with the
+ * truncate primitive, or in a parser which advances, shifts or looks
+ * ahead past the extracted headers.
+ */
+bool P4ProgramReadsPayload(const Json::Value &config);
+
+/**
+ * @brief names of the match-action tables of all the pipelines of a bmv2
+ * JSON configuration, by id (the table ids of the bmv2 event logger).
+ */
+std::map<int, std::string> P4TableNames(const Json::Value &config);
+
+/**
+ * @brief names of the actions of a bmv2 JSON configuration, by id.
+ */
+std::map<int, std::string> P4ActionNames(const Json::Value &config);
+
 } // namespace ns3
 #endif /* HELPER_H */
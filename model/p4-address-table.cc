@@ -0,0 +1,51 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+
+#include "ns3/p4-address-table.h"
+#include "ns3/assert.h"
+#include "ns3/hash.h"
+
+namespace ns3 {
+
+size_t P4AddressTable::AddressHash::operator()(const Address &address) const {
+  // the type and the length are part of the key, as in operator==
+  uint8_t buffer[Address::MAX_SIZE + 2];
+  uint32_t length = address.CopyAllTo(buffer, sizeof(buffer));
+  return Hash64(reinterpret_cast<const char *>(buffer), length);
+}
+
+uint32_t P4AddressTable::Intern(const Address &address) {
+  auto it = m_indices.find(address);
+  if (it != m_indices.end())
+    return it->second;
+  uint32_t index = m_addresses.size();
+  m_indices.emplace(address, index);
+  m_addresses.push_back(address);
+  return index;
+}
+
+const Address &P4AddressTable::Get(uint32_t index) const {
+  NS_ASSERT_MSG(index < m_addresses.size(), "unknown address index " << index);
+  return m_addresses[index];
+}
+
+size_t P4AddressTable::GetSize() const { return m_addresses.size(); }
+
+} // namespace ns3
@@ -0,0 +1,62 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+
+#ifndef P4_ADDRESS_TABLE_H
+#define P4_ADDRESS_TABLE_H
+
+#include "ns3/address.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * @brief Dense indices of the destination addresses seen by the P4 switches.
+ *
+ * A switch keeps the index of the destination of every received packet and
+ * gives the address back to its net device when the packet is sent. The
+ * table is shared by all the switches of a simulation (see
+ * P4GlobalVar::g_addressTable), so one destination has the same index on
+ * every hop, and a lookup is one hash whatever the number of hosts.
+ */
+class P4AddressTable {
+public:
+  //! Index of \p address, a new one the first time it is seen.
+  uint32_t Intern(const Address &address);
+
+  //! The address of \p index, which Intern() returned.
+  const Address &Get(uint32_t index) const;
+
+  size_t GetSize() const;
+
+private:
+  struct AddressHash {
+    size_t operator()(const Address &address) const;
+  };
+
+  std::unordered_map<Address, uint32_t, AddressHash> m_indices;
+  std::vector<Address> m_addresses;
+};
+
+} // namespace ns3
+
+#endif // !P4_ADDRESS_TABLE_H
@@ -0,0 +1,71 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_BURST_CLOCK_H
+#define P4_BURST_CLOCK_H
+
+#include "ns3/nstime.h"
+#include "ns3/simulator.h"
+
+#include <cstdint>
+
+namespace ns3 {
+
+/**
+ * @brief Virtual time of the packets handled by one timer event of a P4
+ * switch stage.
+ *
+ * A stage handles up to its burst size of packets per event, but each
+ * packet still takes one service time: packet i of a burst started at
+ * Simulator::Now() is at Now + i * service time. Its timestamps and
+ * metadata read this time, and it is handed to the net device that much
+ * later, so the departures do not depend on the burst size. Outside of a
+ * burst the virtual time is Simulator::Now().
+ */
+class P4BurstClock {
+ public:
+  P4BurstClock() : slot(0) { }
+
+  //! Start a burst at Simulator::Now() in which every packet takes
+  //! \p per_packet, the current packet is the first one.
+  void start(const Time &per_packet) {
+    perPacket = per_packet;
+    slot = 0;
+  }
+
+  //! The next packet of the burst is the current one.
+  void advance() { slot++; }
+
+  //! End the burst.
+  void stop() { start(Time(0)); }
+
+  //! Time of the current packet after Simulator::Now().
+  Time offset() const { return TimeStep(perPacket.GetTimeStep() * slot); }
+
+  //! Virtual time of the current packet.
+  Time now() const { return Simulator::Now() + offset(); }
+
+ private:
+  Time perPacket;
+  uint64_t slot;
+};
+
+} // namespace ns3
+
+#endif // !P4_BURST_CLOCK_H
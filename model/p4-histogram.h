@@ -0,0 +1,104 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_HISTOGRAM_H
+#define P4_HISTOGRAM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace ns3 {
+
+/**
+ * @brief A log-linear histogram of 64-bit values, as in HdrHistogram.
+ *
+ * Values below 2^kSubBits have a bucket each. Above, every power of two
+ * [2^e, 2^(e+1)) is cut into 2^kSubBits buckets of equal width, so a
+ * bucket is at most 1/2^kSubBits (12.5%) wider than its lower bound.
+ * record() finds the bucket from the highest set bit of the value and the
+ * kSubBits bits below it: a count-leading-zeros, two shifts and an add.
+ * All the buckets are allocated with the histogram.
+ */
+class P4LogHistogram {
+ public:
+  static const unsigned kSubBits = 3;
+  static const size_t kSubBuckets = size_t(1) << kSubBits;
+  static const size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+  void record(uint64_t value) {
+    buckets[bucket_of(value)]++;
+    if (total == 0 || value < lowest) lowest = value;
+    if (value > highest) highest = value;
+    total++;
+    sum += value;
+  }
+
+  void reset() { *this = P4LogHistogram(); }
+
+  uint64_t count() const { return total; }
+  uint64_t min() const { return lowest; }
+  uint64_t max() const { return highest; }
+  double mean() const { return total ? double(sum) / total : 0.0; }
+
+  //! Lower bound of the bucket holding the \p q quantile (0 <= q <= 1),
+  //! 0 for an empty histogram.
+  uint64_t quantile(double q) const {
+    if (total == 0) return 0;
+    uint64_t rank = uint64_t(q * (total - 1));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < kBuckets; b++) {
+      seen += buckets[b];
+      if (seen > rank) return bucket_low(b);
+    }
+    return highest;
+  }
+
+  uint64_t bucket_count(size_t bucket) const { return buckets[bucket]; }
+
+  static size_t bucket_of(uint64_t value) {
+    if (value < kSubBuckets) return size_t(value);
+    unsigned e = 63 - __builtin_clzll(value);
+    return (e - kSubBits + 1) * kSubBuckets +
+           size_t((value >> (e - kSubBits)) & (kSubBuckets - 1));
+  }
+
+  //! Smallest value of \p bucket.
+  static uint64_t bucket_low(size_t bucket) {
+    if (bucket < kSubBuckets) return bucket;
+    unsigned e = unsigned(bucket / kSubBuckets) + kSubBits - 1;
+    return uint64_t(kSubBuckets + bucket % kSubBuckets) << (e - kSubBits);
+  }
+
+  //! Largest value of \p bucket.
+  static uint64_t bucket_high(size_t bucket) {
+    return bucket + 1 < kBuckets ? bucket_low(bucket + 1) - 1 : UINT64_MAX;
+  }
+
+ private:
+  std::array<uint64_t, kBuckets> buckets{};
+  uint64_t total{0};
+  uint64_t sum{0};
+  uint64_t lowest{0};
+  uint64_t highest{0};
+};
+
+} // namespace ns3
+
+#endif // !P4_HISTOGRAM_H
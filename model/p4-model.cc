@@ -25,6 +25,7 @@
 #include "ns3/arp-l3-protocol.h"
 #include "ns3/delay-jitter-estimation.h"
 #include "ns3/ethernet-header.h"
+#include "ns3/fatal-error.h"
 #include "ns3/global.h"
 #include "ns3/helper.h"
 #include "ns3/log.h"
@@ -37,6 +38,7 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <condition_variable>
 #include <deque>
 #include <fstream>
@@ -92,6 +94,10 @@ struct bmv2_hash {
     }
 };
 
+// the stages of all the profiled switches, reported after the last one
+std::unique_ptr<P4StageProfiler> g_stageProfileTotal;
+size_t g_profiledSwitches = 0;
+
 } // namespace
 
 // if REGISTER_HASH calls placed in the anonymous namespace, some compiler can
@@ -105,11 +111,175 @@ packet_id_t P4Model::packet_id = 0;
 TypeId P4Model::GetTypeId(void)
 {
     static TypeId tid = TypeId("ns3::P4Model")
-                            .SetParent<Object>()
-                            .SetGroupName("Network");
+                            .SetParent<ObjectBase>()
+                            .SetGroupName("Network")
+                            .AddAttribute("EgressRateBps",
+                                "Rate of every egress queue in bits per second, shaped "
+                                "with a token bucket on the packet length (0: packet rate)",
+                                UintegerValue(0),
+                                MakeUintegerAccessor(&P4Model::SetEgressRateBps,
+                                    &P4Model::GetEgressRateBps),
+                                MakeUintegerChecker<uint64_t>())
+                            .AddAttribute("EgressBurstBytes",
+                                "Depth of the token bucket of every egress queue in bytes",
+                                UintegerValue(1500),
+                                MakeUintegerAccessor(&P4Model::SetEgressBurstBytes,
+                                    &P4Model::GetEgressBurstBytes),
+                                MakeUintegerChecker<uint32_t>())
+                            .AddAttribute("EgressScheduler",
+                                "How every egress port chooses among its priority queues",
+                                EnumValue(SCHED_STRICT_PRIORITY),
+                                MakeEnumAccessor(&P4Model::SetEgressScheduler,
+                                    &P4Model::GetEgressScheduler),
+                                MakeEnumChecker(SCHED_STRICT_PRIORITY, "StrictPriority",
+                                    SCHED_DRR, "Drr",
+                                    SCHED_WFQ, "Wfq",
+                                    SCHED_PIFO, "Pifo"))
+                            .AddAttribute("DrrQuantumBytes",
+                                "DRR quantum of the egress priority queues (times their weight)",
+                                UintegerValue(1500),
+                                MakeUintegerAccessor(&P4Model::SetDrrQuantumBytes,
+                                    &P4Model::GetDrrQuantumBytes),
+                                MakeUintegerChecker<uint32_t>(1))
+                            .AddAttribute("PifoRankField",
+                                "Metadata field holding the PIFO rank of a packet, read when "
+                                "the P4 program is loaded",
+                                StringValue(P4_PIFO_RANK_SRC),
+                                MakeStringAccessor(&P4Model::m_pifoRankField),
+                                MakeStringChecker())
+                            .AddAttribute("ParserLatency",
+                                "Time a packet spends in the parser. With any non zero stage "
+                                "latency, packets cross the pipeline stages on simulated time "
+                                "instead of being throttled by P4GlobalVar::g_switchBottleNeck",
+                                TimeValue(Time(0)),
+                                MakeTimeAccessor(&P4Model::m_parserLatency),
+                                MakeTimeChecker(Time(0)))
+                            .AddAttribute("MauStageLatency",
+                                "Time a packet spends in one match-action stage",
+                                TimeValue(Time(0)),
+                                MakeTimeAccessor(&P4Model::m_mauStageLatency),
+                                MakeTimeChecker(Time(0)))
+                            .AddAttribute("DeparserLatency",
+                                "Time a packet spends in the deparser",
+                                TimeValue(Time(0)),
+                                MakeTimeAccessor(&P4Model::m_deparserLatency),
+                                MakeTimeChecker(Time(0)))
+                            .AddAttribute("TrafficManagerLatency",
+                                "Time between the end of ingress and the egress queues",
+                                TimeValue(Time(0)),
+                                MakeTimeAccessor(&P4Model::m_trafficManagerLatency),
+                                MakeTimeChecker(Time(0)))
+                            .AddAttribute("IngressMauStages",
+                                "Match-action stages of ingress (0: one per ingress table "
+                                "of the P4 program)",
+                                UintegerValue(0),
+                                MakeUintegerAccessor(&P4Model::m_ingressMauStages),
+                                MakeUintegerChecker<uint32_t>())
+                            .AddAttribute("EgressMauStages",
+                                "Match-action stages of egress (0: one per egress table "
+                                "of the P4 program)",
+                                UintegerValue(0),
+                                MakeUintegerAccessor(&P4Model::m_egressMauStages),
+                                MakeUintegerChecker<uint32_t>())
+                            .AddAttribute("PacketContextCapacity",
+                                "Initial slots of the ring keeping the ns-3 context of the "
+                                "packets in the switch (rounded up to a power of two). The ring "
+                                "doubles when the switch holds more packets, a live context is "
+                                "never reclaimed",
+                                UintegerValue(16384),
+                                MakeUintegerAccessor(&P4Model::SetPacketContextCapacity,
+                                    &P4Model::GetPacketContextCapacity),
+                                MakeUintegerChecker<uint32_t>(1))
+                            .AddAttribute("SharePayload",
+                                "Keep the bytes of a received packet past the headers of the P4 "
+                                "program in the ns3::Packet, shared by all the copies of the "
+                                "packet, instead of copying them into every bm packet",
+                                BooleanValue(true),
+                                MakeBooleanAccessor(&P4Model::m_sharePayload),
+                                MakeBooleanChecker())
+                            .AddAttribute("CloneSnapshotRatio",
+                                "Copy the parsed headers of every ingress packet for its clones, "
+                                "instead of parsing every clone again, once at least one packet "
+                                "in CloneSnapshotRatio is cloned at ingress (0 to always parse)",
+                                UintegerValue(10),
+                                MakeUintegerAccessor(&P4Model::m_cloneSnapshotRatio),
+                                MakeUintegerChecker<uint32_t>())
+                            .AddAttribute("HistogramFile",
+                                "File where the sojourn time, occupancy and packet size "
+                                "histograms of the egress queues are written at "
+                                "Simulator::Destroy, none if empty",
+                                StringValue(""),
+                                MakeStringAccessor(&P4Model::SetHistogramFile,
+                                    &P4Model::GetHistogramFile),
+                                MakeStringChecker())
+                            .AddAttribute("StageProfiling",
+                                "Count the CPU time of the receive, parse, ingress, queue, "
+                                "egress, deparse and transmit stages, printed per switch and "
+                                "for all the switches at Simulator::Destroy",
+                                BooleanValue(false),
+                                MakeBooleanAccessor(&P4Model::SetStageProfiling,
+                                    &P4Model::GetStageProfiling),
+                                MakeBooleanChecker())
+                            .AddAttribute("TableStatistics",
+                                "Count the lookups and hits of every table and the calls of "
+                                "every action of the P4 program, printed at Simulator::Destroy. "
+                                "Takes over the bmv2 event logger of the process, see "
+                                "P4TableStatistics",
+                                BooleanValue(false),
+                                MakeBooleanAccessor(&P4Model::SetTableStatistics,
+                                    &P4Model::GetTableStatisticsEnabled),
+                                MakeBooleanChecker())
+                            .AddAttribute("TableTiming",
+                                "With TableStatistics, also count the CPU time of every table",
+                                BooleanValue(false),
+                                MakeBooleanAccessor(&P4Model::SetTableTiming,
+                                    &P4Model::GetTableTiming),
+                                MakeBooleanChecker())
+                            .AddTraceSource("Ingress",
+                                "A packet went through the ingress pipeline",
+                                MakeTraceSourceAccessor(&P4Model::m_ingressTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("IngressDrop",
+                                "A packet was dropped at the end of ingress",
+                                MakeTraceSourceAccessor(&P4Model::m_ingressDropTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("Enqueue",
+                                "A packet entered an egress queue",
+                                MakeTraceSourceAccessor(&P4Model::m_enqueueTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("Dequeue",
+                                "A packet left an egress queue for the egress pipeline",
+                                MakeTraceSourceAccessor(&P4Model::m_dequeueTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("EgressDrop",
+                                "A packet was dropped at the end of egress",
+                                MakeTraceSourceAccessor(&P4Model::m_egressDropTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("Resubmit",
+                                "A packet goes back to the start of ingress",
+                                MakeTraceSourceAccessor(&P4Model::m_resubmitTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("Recirculate",
+                                "A deparsed packet goes back to the start of ingress",
+                                MakeTraceSourceAccessor(&P4Model::m_recirculateTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("Clone",
+                                "A packet was cloned at ingress or egress (the event is "
+                                "the clone's)",
+                                MakeTraceSourceAccessor(&P4Model::m_cloneTrace),
+                                "ns3::P4Model::PipelineEventCallback")
+                            .AddTraceSource("Transmit",
+                                "A packet was handed to the net device",
+                                MakeTraceSourceAccessor(&P4Model::m_transmitTrace),
+                                "ns3::P4Model::PipelineEventCallback");
     return tid;
 }
 
+TypeId P4Model::GetInstanceTypeId(void) const
+{
+    return GetTypeId();
+}
+
 class P4Model::MirroringSessions {
 public:
     bool add_session(mirror_id_t mirror_id,
@@ -161,8 +331,11 @@ private:
 // Resubmit packets are dropped if the queue is full in order to make sure the
 // ingress thread cannot deadlock. We do the same for recirculate packets even
 // though the same argument does not apply for them. Enqueueing normal packets
-// is blocking (back pressure is applied to the interface).
-class P4Model::InputBuffer {
+// is blocking (back pressure is applied to the interface). With a locking
+// policy that cannot block (single ns-3 thread), normal packets are dropped
+// as well when the queue is full.
+template <typename LockingPolicy>
+class P4Model::InputBufferT {
 public:
     enum class PacketType {
         NORMAL,
@@ -171,7 +344,7 @@ public:
         SENTINEL // signal for the ingress thread to terminate
     };
 
-    InputBuffer(size_t capacity_hi, size_t capacity_lo)
+    InputBufferT(size_t capacity_hi, size_t capacity_lo)
         : capacity_hi(capacity_hi)
         , capacity_lo(capacity_lo)
     {
@@ -220,18 +393,25 @@ public:
         return capacity_hi + capacity_lo;
     }
 
+    size_t size() const
+    {
+        Lock lock(mutex);
+        return queue_hi.size() + queue_lo.size();
+    }
+
 private:
-    using Mutex = std::mutex;
-    using Lock = std::unique_lock<Mutex>;
+    using Mutex = typename LockingPolicy::Mutex;
+    using Lock = typename LockingPolicy::Lock;
+    using CondVar = typename LockingPolicy::CondVar;
     using QueueImpl = std::deque<std::unique_ptr<bm::Packet>>;
 
     int push_front(QueueImpl* queue, size_t capacity,
-        std::condition_variable* cvar,
+        CondVar* cvar,
         std::unique_ptr<bm::Packet>&& item, bool blocking)
     {
         Lock lock(mutex);
         while (queue->size() == capacity) {
-            if (!blocking)
+            if (!blocking || !LockingPolicy::can_block)
                 return 0;
             cvar->wait(lock);
         }
@@ -241,10 +421,10 @@ private:
         return 1;
     }
 
-    mutable std::mutex mutex;
-    mutable std::condition_variable cvar_can_push_hi;
-    mutable std::condition_variable cvar_can_push_lo;
-    mutable std::condition_variable cvar_can_pop;
+    mutable Mutex mutex;
+    mutable CondVar cvar_can_push_hi;
+    mutable CondVar cvar_can_push_lo;
+    mutable CondVar cvar_can_pop;
     size_t capacity_hi;
     size_t capacity_lo;
     QueueImpl queue_hi;
@@ -291,9 +471,7 @@ P4Model::P4Model(P4NetDevice* netDevice, bool enable_swap,
     import_primitives();
 
     // event for threads local
-    worker_id = 0;
     m_ingressTimerEvent = EventId(); // default initial value
-    m_egressTimerEvent = EventId(); // default initial value
     m_transmitTimerEvent = EventId(); // default initial value
     // default time setting for event loop.
 
@@ -302,9 +480,13 @@ P4Model::P4Model(P4NetDevice* netDevice, bool enable_swap,
     m_ingressTimeReference = Time(time_ref_fast);
     m_egressTimeReference = Time(time_ref_bottle_neck);
     m_transmitTimeReference = Time(time_ref_fast);
+    m_schedulingMode = P4GlobalVar::g_schedulingMode;
+    m_burstSize = std::max<size_t>(P4GlobalVar::g_switchBurstSize, 1);
+    // the egress queue rates shape the departures, polling also charges
+    // the switch bottleneck on every port
+    m_egressServiceTime = (m_schedulingMode == POLLING_SCHEDULE) ? m_egressTimeReference : Time(0);
 
     // ns3 settings init @mingyu
-    address_num = 0;
 
     static int switch_id = 1;
     p4_switch_ID = switch_id++;
@@ -317,6 +499,10 @@ P4Model::P4Model(P4NetDevice* netDevice, bool enable_swap,
     tracing_egress_drop = 0;
     tracing_total_in_pkts = 0;
     tracing_total_out_pkts = 0;
+    tracing_bm_packets_created = 0;
+
+    // attributes (Config::SetDefault values)
+    ObjectBase::ConstructSelf(AttributeConstructionList());
 }
 
 int P4Model::init(int argc, char* argv[])
@@ -372,6 +558,7 @@ int P4Model::init(int argc, char* argv[])
                                     std::string("-pipeline.log");
         opt_parser.thrift_port = thriftPort++;
         opt_parser.console_logging = true;
+        m_eventLoggerAddr = opt_parser.event_logger_addr;
 
         //! Initialize the switch using an bm::OptionsParser instance.
         int status = this->init_from_options_parser(opt_parser);
@@ -409,6 +596,7 @@ int P4Model::InitFromCommandLineOptionsLocal(int argc, char* argv[], bm::TargetP
 
     bm::OptionsParser parser;
     parser.parse(argc, argv, tp);
+    m_eventLoggerAddr = parser.event_logger_addr;
     std::shared_ptr<bm::TransportIface> transport = nullptr;
     int status = 0;
     if (transport == nullptr) {
@@ -435,15 +623,13 @@ int P4Model::InitFromCommandLineOptionsLocal(int argc, char* argv[], bm::TargetP
  */
 int P4Model::receive_(port_t port_num, const char* buffer, int len)
 {
-    
-    /**
-     * @brief we limit the packet buffer to original size + 512 bytes, 
-     * which means we cannot add more than 512 bytes of header data 
-     * to the packet, which should be more than enough
-     * 
-     */
-    auto packet = new_packet_ptr(port_num, packet_id++, len,
-        bm::PacketBuffer(len + 512, buffer, len));
+    // room for all the headers the deparser may add, see size_packet_headroom.
+    // The id comes from the same counter as ReceivePacket, so the packet has
+    // no context and never finds the context of another packet.
+    packet_id++;
+    auto packet = new_packet_ptr(port_num, m_pktID++, len,
+        bm::PacketBuffer(len + m_packetHeadroom, buffer, len));
+    tracing_bm_packets_created++;
 
 #ifdef BMNANOMSG_ON
     BMELOG(packet_in, *packet);
@@ -452,22 +638,27 @@ int P4Model::receive_(port_t port_num, const char* buffer, int len)
     phv->reset_metadata();
     RegisterAccess::clear_all(packet.get());
 
-    phv->get_field("standard_metadata.ingress_port").set(port_num);
+    m_fields.ingress_port.get(phv).set(port_num);
     // using packet register 0 to store length, this register will be updated for
     // each add_header / remove_header primitive call
     packet->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX, len);
-    phv->get_field("standard_metadata.packet_length").set(len);
-    Field& f_instance_type = phv->get_field("standard_metadata.instance_type");
+    m_fields.packet_length.get(phv).set(len);
+    Field& f_instance_type = m_fields.instance_type.get(phv);
     f_instance_type.set(PKT_INSTANCE_TYPE_NORMAL);
 
-    if (phv->has_field("intrinsic_metadata.ingress_global_timestamp")) {
+    if (m_fields.ingress_global_timestamp.present) {
         uint64_t ingress_global_timestamp = Simulator::Now().GetMicroSeconds();
-        phv->get_field("intrinsic_metadata.ingress_global_timestamp")
+        m_fields.ingress_global_timestamp.get(phv)
             .set(ingress_global_timestamp);
     }
 
+    if (HasPipelineLatency()) {
+        EnterPipelineLine(m_ingressLine, GetIngressLatency(), std::move(packet));
+        return 0;
+    }
     input_buffer->push_front(
         InputBuffer::PacketType::NORMAL, std::move(packet));
+    ScheduleIngress();
     return 0;
 }
 
@@ -477,7 +668,19 @@ int P4Model::receive_(port_t port_num, const char* buffer, int len)
  */
 void P4Model::start_and_return_()
 {
+    open_trace_sink();
+    resolve_field_handles();
     check_queueing_metadata();
+    Json::Value config = ParseP4Json(get_config());
+    count_pipeline_tables(config);
+    size_packet_headroom(config);
+    size_payload_split(config);
+    setup_table_statistics(config);
+
+    // with event driven scheduling, the events are only armed on demand
+    if (m_schedulingMode == EVENT_DRIVEN_SCHEDULE) {
+        return;
+    }
 
     // start the ingress local thread
     if (!m_ingressTimeReference.IsZero()) {
@@ -487,13 +690,7 @@ void P4Model::start_and_return_()
                                         &P4Model::RunIngressTimerEvent, this);
     }
 
-    // start the egress local thread
-    if (!m_egressTimeReference.IsZero()) {
-        // NS_LOG_INFO ("Scheduling initial timer event using m_egressTimeReference = "
-            // << m_egressTimeReference.GetNanoSeconds() << " ns");
-        m_egressTimerEvent = Simulator::Schedule(m_egressTimeReference, 
-                                        &P4Model::RunEgressTimerEvent, this);
-    }
+    // the egress ports arm their own departure events, see ScheduleEgress
 
     // start the transmit local thread
     if (!m_egressTimeReference.IsZero()) {
@@ -508,11 +705,28 @@ void P4Model::swap_notify_()
 {
     bm::Logger::get()->debug(
         "simple_switch target has been notified of a config swap");
+    resolve_field_handles();
     check_queueing_metadata();
+    Json::Value config = ParseP4Json(get_config());
+    count_pipeline_tables(config);
+    size_packet_headroom(config);
+    size_payload_split(config);
+    setup_table_statistics(config);
 }
 
 P4Model::~P4Model()
 {
+    for (auto& portClock : m_egressPorts) {
+        portClock.event.Cancel();
+    }
+    m_ingressLine.event.Cancel();
+    m_egressLine.event.Cancel();
+    m_traceCloseEvent.Cancel(); // the sink closes with this switch
+    if (m_histogramDumpEvent.IsRunning()) {
+        write_histogram_file(); // a switch deleted before Simulator::Destroy
+    }
+    report_stage_profile();
+    report_table_statistics();
     input_buffer->push_front(
         InputBuffer::PacketType::SENTINEL, nullptr);
     for (size_t i = 0; i < nb_egress_threads; i++) {
@@ -524,6 +738,10 @@ P4Model::~P4Model()
             continue;
     }
     output_buffer.push_front(nullptr);
+
+    bm::Logger::get()->info("Switch {}: {} bm packets created for {} received, {} sent",
+        p4_switch_ID, tracing_bm_packets_created, tracing_total_in_pkts,
+        tracing_total_out_pkts);
 }
 
 void P4Model::reset_target_state_()
@@ -549,6 +767,11 @@ bool P4Model::mirroring_get_session(mirror_id_t mirror_id,
     return mirroring_sessions->get_session(mirror_id, config);
 }
 
+void P4Model::set_burst_size(size_t burst_size)
+{
+    m_burstSize = std::max<size_t>(burst_size, 1);
+}
+
 int P4Model::set_egress_priority_queue_depth(size_t port, size_t priority,
     const size_t depth_pkts)
 {
@@ -587,6 +810,346 @@ int P4Model::set_all_egress_queue_rates(const uint64_t rate_pps)
     return 0;
 }
 
+int P4Model::set_egress_priority_queue_rate_bps(size_t port, size_t priority,
+    const uint64_t rate_bps, const size_t burst_bytes)
+{
+    egress_buffers.set_rate_bps(port, priority, rate_bps, burst_bytes);
+    return 0;
+}
+
+int P4Model::set_egress_queue_rate_bps(size_t port, const uint64_t rate_bps,
+    const size_t burst_bytes)
+{
+    egress_buffers.set_rate_bps(port, rate_bps, burst_bytes);
+    return 0;
+}
+
+int P4Model::set_all_egress_queue_rates_bps(const uint64_t rate_bps, const size_t burst_bytes)
+{
+    egress_buffers.set_rate_bps_for_all(rate_bps, burst_bytes);
+    // the token buckets shape every port, polling no longer charges the
+    // switch bottleneck on top of them
+    m_egressServiceTime = (m_schedulingMode == POLLING_SCHEDULE && rate_bps == 0)
+        ? m_egressTimeReference : Time(0);
+    return 0;
+}
+
+void P4Model::SetEgressRateBps(uint64_t rate_bps)
+{
+    m_egressRateBps = rate_bps;
+    set_all_egress_queue_rates_bps(m_egressRateBps, m_egressBurstBytes);
+}
+
+uint64_t P4Model::GetEgressRateBps() const
+{
+    return m_egressRateBps;
+}
+
+void P4Model::SetEgressBurstBytes(uint32_t burst_bytes)
+{
+    m_egressBurstBytes = burst_bytes;
+    if (m_egressRateBps != 0) {
+        set_all_egress_queue_rates_bps(m_egressRateBps, m_egressBurstBytes);
+    }
+}
+
+uint32_t P4Model::GetEgressBurstBytes() const
+{
+    return m_egressBurstBytes;
+}
+
+int P4Model::set_egress_scheduler(size_t port, EgressScheduler scheduler)
+{
+    egress_buffers.set_scheduler(port, scheduler);
+    return 0;
+}
+
+int P4Model::set_all_egress_schedulers(EgressScheduler scheduler)
+{
+    egress_buffers.set_scheduler_for_all(scheduler);
+    return 0;
+}
+
+int P4Model::set_egress_priority_queue_weight(size_t port, size_t priority,
+    const uint32_t weight)
+{
+    egress_buffers.set_weight(port, priority, weight);
+    return 0;
+}
+
+int P4Model::set_all_egress_drr_quanta(const size_t quantum_bytes)
+{
+    egress_buffers.set_quantum_for_all(quantum_bytes);
+    return 0;
+}
+
+void P4Model::SetEgressScheduler(EgressScheduler scheduler)
+{
+    m_egressScheduler = scheduler;
+    set_all_egress_schedulers(scheduler);
+}
+
+EgressScheduler P4Model::GetEgressScheduler() const
+{
+    return m_egressScheduler;
+}
+
+void P4Model::SetDrrQuantumBytes(uint32_t quantum_bytes)
+{
+    m_drrQuantumBytes = quantum_bytes;
+    set_all_egress_drr_quanta(quantum_bytes);
+}
+
+uint32_t P4Model::GetDrrQuantumBytes() const
+{
+    return m_drrQuantumBytes;
+}
+
+/**
+ * @brief Copy the byte and packet tags of \p from to \p to. The bytes of
+ * \p to start \p offset bytes later than the ones of \p from (the Ethernet
+ * header is only in \p from).
+ */
+static void CopyNs3Tags(Ptr<const ns3::Packet> from, Ptr<ns3::Packet> to, uint32_t offset)
+{
+    ByteTagIterator byteTags = from->GetByteTagIterator();
+    while (byteTags.HasNext()) {
+        ByteTagIterator::Item item = byteTags.Next();
+        Tag* tag = dynamic_cast<Tag*>(item.GetTypeId().GetConstructor()());
+        if (tag == nullptr) {
+            continue;
+        }
+        item.GetTag(*tag);
+        uint32_t start = std::max(item.GetStart(), offset) - offset;
+        uint32_t end = std::min(std::max(item.GetEnd(), offset) - offset, to->GetSize());
+        if (start < end) {
+            to->AddByteTag(*tag, start, end);
+        }
+        delete tag;
+    }
+    PacketTagIterator packetTags = from->GetPacketTagIterator();
+    while (packetTags.HasNext()) {
+        PacketTagIterator::Item item = packetTags.Next();
+        Tag* tag = dynamic_cast<Tag*>(item.GetTypeId().GetConstructor()());
+        if (tag == nullptr) {
+            continue;
+        }
+        item.GetTag(*tag);
+        to->AddPacketTag(*tag);
+        delete tag;
+    }
+}
+
+/**
+ * @brief \p packet is a new copy (clone or replica) of a received packet,
+ * it shares the context of the received packet.
+ */
+void P4Model::acquire_context(bm::Packet* packet)
+{
+    m_contexts.acquire(packet->get_packet_id());
+}
+
+/**
+ * @brief \p packet leaves the switch (sent or dropped), the context of the
+ * received packet goes with its last copy.
+ */
+void P4Model::release_context(bm::Packet* packet)
+{
+    m_contexts.release(packet->get_packet_id());
+}
+
+void P4Model::SetPacketContextCapacity(uint32_t capacity)
+{
+    // the contexts of the packets already in the switch are lost
+    m_contexts = PacketContextSlab<PacketContext>(capacity);
+}
+
+uint32_t P4Model::GetPacketContextCapacity() const
+{
+    return m_contexts.capacity();
+}
+
+P4Model::QueueHistograms& P4Model::queue_histograms(port_t port, size_t priority)
+{
+    size_t index = port * nb_queues_per_port + priority;
+    if (index >= m_queueHistograms.size()) {
+        m_queueHistograms.resize(index + 1);
+    }
+    if (!m_queueHistograms[index]) {
+        m_queueHistograms[index].reset(new QueueHistograms());
+    }
+    return *m_queueHistograms[index];
+}
+
+void P4Model::ResetQueueHistograms()
+{
+    m_queueHistograms.clear();
+}
+
+/**
+ * @brief For every egress queue, one summary line and one line per non
+ * empty bucket of each histogram:
+ *   # port,priority,metric,count,min,mean,p50,p99,p999,max
+ *   port,priority,metric,<bucket low>,<bucket high>,<count>
+ */
+void P4Model::DumpQueueHistograms(std::ostream& os) const
+{
+    os << "# switch " << p4_switch_ID
+       << ": sojourn in ns, occupancy in packets, size in bytes" << std::endl;
+    for (size_t index = 0; index < m_queueHistograms.size(); index++) {
+        if (!m_queueHistograms[index]) {
+            continue;
+        }
+        const QueueHistograms& queue = *m_queueHistograms[index];
+        size_t port = index / nb_queues_per_port;
+        size_t priority = index % nb_queues_per_port;
+        const std::pair<const char*, const P4LogHistogram*> metrics[] = {
+            { "sojourn", &queue.sojourn },
+            { "occupancy", &queue.occupancy },
+            { "size", &queue.size },
+        };
+        for (const auto& metric : metrics) {
+            const P4LogHistogram& h = *metric.second;
+            os << "# " << port << "," << priority << "," << metric.first << ","
+               << h.count() << "," << h.min() << "," << h.mean() << ","
+               << h.quantile(0.5) << "," << h.quantile(0.99) << ","
+               << h.quantile(0.999) << "," << h.max() << std::endl;
+            for (size_t b = 0; b < P4LogHistogram::kBuckets; b++) {
+                if (h.bucket_count(b) != 0) {
+                    os << port << "," << priority << "," << metric.first << ","
+                       << P4LogHistogram::bucket_low(b) << ","
+                       << P4LogHistogram::bucket_high(b) << ","
+                       << h.bucket_count(b) << std::endl;
+                }
+            }
+        }
+    }
+}
+
+void P4Model::SetHistogramFile(std::string path)
+{
+    m_histogramFile = path;
+    m_histogramDumpEvent.Cancel();
+    if (!path.empty()) {
+        m_histogramDumpEvent = Simulator::ScheduleDestroy(&P4Model::write_histogram_file, this);
+    }
+}
+
+std::string P4Model::GetHistogramFile() const
+{
+    return m_histogramFile;
+}
+
+void P4Model::SetStageProfiling(bool enable)
+{
+    if (enable == bool(m_profiler)) {
+        return;
+    }
+    if (enable) {
+        m_profiler.reset(new P4StageProfiler());
+        if (!g_stageProfileTotal) {
+            g_stageProfileTotal.reset(new P4StageProfiler());
+        }
+        g_profiledSwitches++;
+        m_profileReportEvent = Simulator::ScheduleDestroy(&P4Model::report_stage_profile, this);
+    } else {
+        // the profile so far is dropped
+        m_profileReportEvent.Cancel();
+        m_profiler.reset();
+        g_profiledSwitches--;
+    }
+}
+
+bool P4Model::GetStageProfiling() const
+{
+    return bool(m_profiler);
+}
+
+/**
+ * @brief Print the stage profile of this switch, and the one of all the
+ * profiled switches after the last of them.
+ */
+void P4Model::report_stage_profile()
+{
+    if (!m_profiler) {
+        return;
+    }
+    m_profileReportEvent.Cancel();
+    m_profiler->report(std::cout, "P4 switch " + std::to_string(p4_switch_ID) + " stage profile");
+    g_stageProfileTotal->merge(*m_profiler);
+    m_profiler.reset();
+    if (--g_profiledSwitches == 0) {
+        g_stageProfileTotal->report(std::cout, "All P4 switches stage profile");
+        g_stageProfileTotal.reset();
+    }
+}
+
+const P4TableStatistics* P4Model::GetTableStatistics() const
+{
+    return m_tableStats.get();
+}
+
+void P4Model::SetTableStatistics(bool enable)
+{
+    m_tableStatsEnabled = enable;
+    setup_table_statistics(ParseP4Json(get_config()));
+}
+
+bool P4Model::GetTableStatisticsEnabled() const
+{
+    return m_tableStatsEnabled;
+}
+
+void P4Model::SetTableTiming(bool timing)
+{
+    m_tableTiming = timing;
+    setup_table_statistics(ParseP4Json(get_config()));
+}
+
+bool P4Model::GetTableTiming() const
+{
+    return m_tableTiming;
+}
+
+/**
+ * @brief (Re)start the table statistics with the names of the loaded P4
+ * program, the counts so far are dropped.
+ */
+void P4Model::setup_table_statistics(const Json::Value &config)
+{
+    if (!m_tableStatsEnabled) {
+        m_tableStats.reset();
+        m_tableStatsReportEvent.Cancel();
+        return;
+    }
+    m_tableStats.reset(new P4TableStatistics(config, m_tableTiming, m_eventLoggerAddr));
+    if (!m_tableStatsReportEvent.IsRunning()) {
+        m_tableStatsReportEvent = Simulator::ScheduleDestroy(&P4Model::report_table_statistics, this);
+    }
+}
+
+void P4Model::report_table_statistics()
+{
+    if (!m_tableStats) {
+        return;
+    }
+    m_tableStatsReportEvent.Cancel();
+    m_tableStats->Report(std::cout, "P4 switch " + std::to_string(p4_switch_ID) + " tables");
+    m_tableStats.reset();
+    m_tableStatsEnabled = false;
+}
+
+void P4Model::write_histogram_file()
+{
+    m_histogramDumpEvent.Cancel();
+    std::ofstream file(m_histogramFile);
+    if (!file.is_open()) {
+        bm::Logger::get()->warn("Cannot open the histogram file {}", m_histogramFile);
+        return;
+    }
+    DumpQueueHistograms(file);
+}
+
 void P4Model::transmit_thread()
 {
 
@@ -606,115 +1169,46 @@ void P4Model::transmit_thread()
 
     m_re_pktID++; // the packet number should be
 
-    PHV* phv = packet->get_phv();
-
-    // ==================Take info from the p4 bm::packet==================
-    uint16_t protocol;
-    if (phv->has_field(P4GlobalVar::ns3i_protocol_1)) {
-        protocol = phv->get_field(P4GlobalVar::ns3i_protocol_1).get_int();
-    } else if (phv->has_field(P4GlobalVar::ns3i_protocol_2)) {
-        protocol = phv->get_field(P4GlobalVar::ns3i_protocol_2).get_int();
-    } else {
-        std::cout << "No protocol for sending ns-3 packet!" << std::endl;
-        protocol = 0;
+    // ==================Take info from the packet context==================
+    // (packets injected by receive_() have no context)
+    uint64_t transmit_start = m_profiler ? P4StageProfiler::ticks() : 0;
+    const PacketContext* context = m_contexts.find(packet->get_packet_id());
+    uint16_t protocol = context ? context->protocol : 0;
+    Address destination = context ? P4GlobalVar::g_addressTable.Get(context->destination)
+                                  : Address();
+    int port = packet->get_egress_port();
+
+    // tranfer bm::packet to ns3::packet: the only copy of the bytes, into one
+    // heap ns3::packet, without the Ethernet header added at ingress
+    const uint8_t* bm2Buffer = reinterpret_cast<const uint8_t*>(packet->data());
+    uint32_t bm2Length = packet->get_data_size();
+    uint32_t ethLength = std::min(bm2Length, EthernetHeader().GetSerializedSize());
+    Ptr<ns3::Packet> packetOut = Create<ns3::Packet>(bm2Buffer + ethLength, bm2Length - ethLength);
+    if (context && context->payload) {
+        packetOut->AddAtEnd(context->payload);
     }
 
-    int des_idx = 0;
-    if (phv->has_field(P4GlobalVar::ns3i_destination_1)) {
-        des_idx = phv->get_field(P4GlobalVar::ns3i_destination_1).get_int();
-    } else if (phv->has_field(P4GlobalVar::ns3i_destination_2)) {
-        des_idx = phv->get_field(P4GlobalVar::ns3i_destination_2).get_int();
-    } else {
-        std::cout << "No destnation for sending ns-3 packet!" << std::endl;
-        des_idx = 0;
+    // give back the tags of the ns3::packet received at ingress
+    if (context && context->tags) {
+        CopyNs3Tags(context->tags, packetOut, ethLength);
     }
-
-    int port = 0;
-    // take the port info into p4, here the port using egress_port
-    if (phv->has_field("standard_metadata.egress_port")) {
-        port = phv->get_field("standard_metadata.egress_port").get_int();
-    }
-
-    // tranfer bm::packet to ns3::packet
-    void* bm2Buffer = packet.get()->data();
-    size_t bm2Length = packet.get()->get_data_size();
-    ns3::Packet ns3Packet((uint8_t*)bm2Buffer, bm2Length);
-
-    if (P4GlobalVar::ns3_p4_tracing_dalay_ByteTag) {
-        // add the ByteTag of the ns3::packet (for tracing delay etc)
-        int64_t src_pkt_id = -1;
-        if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-            src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_1).get_uint64();
-        } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-            src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_2).get_uint64();
-        } else {
-            std::cout << "tag set from ns3 -> bmv2 recover failed." << std::endl;
-        }
-        m_tag_queue_mutex.lock();
-
-        if (tag_map.find(src_pkt_id) != tag_map.end()) {
-            DelayJitterEstimationTimestampTag rdjtag = tag_map.find(src_pkt_id)->second;
-            ns3Packet.AddByteTag(rdjtag);
-            tag_map.erase(src_pkt_id); // Clear the item to avoid excessive map
-        }
-        m_tag_queue_mutex.unlock();
+    if (m_profiler) {
+        m_profiler->add(P4_STAGE_TRANSMIT, transmit_start);
     }
 
-    Ptr<ns3::Packet> packetOut(&ns3Packet);
-
     tracing_total_out_pkts++;
-    m_pNetDevice->SendNs3Packet(packetOut, port, protocol, destination_list[des_idx]);
-
-    if (P4GlobalVar::ns3_p4_tracing_dalay_sim) {
-        if (p4_switch_ID == 1) {
-            int priority = -1;
-            PHV* phv = packet->get_phv();
-            if (phv->has_field("standard_metadata.priority")) {
-                priority = phv->get_field("standard_metadata.priority").get_int();
-            }
-
-            int64_t src_pkt_id = -1;
-            if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_1).get_uint64();
-            } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_2).get_uint64();
-            } else {
-                std::cout << "tag set from ns3 -> bmv2 recover failed." << std::endl;
-            }
-
-            std::string filename = "./scratch-data/p4-codel/sim_delay_out_switch_1.csv";
-            std::ofstream sim_delay_file(filename, std::ios::app);
-            if (sim_delay_file.is_open()) {
-                sim_delay_file << "SimOut," << src_pkt_id << "," << 
-                                priority << "," << Simulator::Now() << std::endl;
-            }
-            sim_delay_file.close();
-        }
-        if (p4_switch_ID == 2) {
-            int priority = -1;
-            PHV* phv = packet->get_phv();
-            if (phv->has_field("standard_metadata.priority")) {
-                priority = phv->get_field("standard_metadata.priority").get_int();
-            }
-
-            int64_t src_pkt_id = -1;
-            if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_1).get_uint64();
-            } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_2).get_uint64();
-            } else {
-                std::cout << "tag set from ns3 -> bmv2 recover failed." << std::endl;
-            }
-
-            std::string filename = "./scratch-data/p4-codel/sim_delay_out_switch_2.csv";
-            std::ofstream sim_delay_file(filename, std::ios::app);
-            if (sim_delay_file.is_open()) {
-                sim_delay_file << "SimOut," << src_pkt_id << "," << 
-                                priority << "," << Simulator::Now() << std::endl;
-            }
-            sim_delay_file.close();
-        }
+    trace_pipeline(m_transmitTrace, packet.get(), port);
+    Time offset = m_burstClock.offset();
+    if (offset.IsZero()) {
+        m_pNetDevice->SendNs3Packet(packetOut, port, protocol, destination);
+    } else {
+        // the packet leaves at its time in the transmit burst
+        Simulator::Schedule(offset, &P4NetDevice::SendNs3Packet, m_pNetDevice,
+            packetOut, port, protocol, destination);
     }
+    release_context(packet.get());
+
+    trace_packet(P4_TRACE_SWITCH_OUT, packet->get_packet_id(), packet->get_phv());
 
     if (P4GlobalVar::ns3_p4_tracing_control) {
         if (tracing_control_loop_num < 100) {
@@ -771,59 +1265,46 @@ void P4Model::enqueue(port_t egress_port, std::unique_ptr<bm::Packet>&& packet)
     PHV* phv = packet->get_phv();
 
     if (with_queueing_metadata) {
-        uint64_t enq_time_stamp = Simulator::Now().GetMicroSeconds();
-        phv->get_field("queueing_metadata.enq_timestamp").set(enq_time_stamp);
-        phv->get_field("queueing_metadata.enq_qdepth")
+        uint64_t enq_time_stamp = m_burstClock.now().GetMicroSeconds();
+        m_fields.enq_timestamp.get(phv).set(enq_time_stamp);
+        m_fields.enq_qdepth.get(phv)
             .set(egress_buffers.size(egress_port));
     }
 
-    size_t priority = phv->has_field(SSWITCH_PRIORITY_QUEUEING_SRC) ? 
-                        phv->get_field(SSWITCH_PRIORITY_QUEUEING_SRC).get<size_t>() : 0u;
+    size_t priority = m_fields.queueing_priority.present ? 
+                        m_fields.queueing_priority.get(phv).get<size_t>() : 0u;
     if (priority >= nb_queues_per_port) {
         bm::Logger::get()->error("Priority out of range, dropping packet");
+        release_context(packet.get());
         return;
     }
 
-    egress_buffers.push_front(
-        egress_port, nb_queues_per_port - 1 - priority,
-        std::move(packet));
-
-    if (P4GlobalVar::ns3_p4_tracing_dalay_sim) {
-        if (p4_switch_ID == 1) {
-            int64_t src_pkt_id = -1;
-            if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_1).get_uint64();
-            } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_2).get_uint64();
-            } else {
-                std::cout << "tag set from ns3 -> bmv2 recover failed." << std::endl;
-            }
-
-            std::string filename = "./scratch-data/p4-codel/sim_in_queue_1.csv";
-            std::ofstream sim_delay_file(filename, std::ios::app);
-            if (sim_delay_file.is_open()) {
-                sim_delay_file << "SimQIn," << src_pkt_id << "," << Simulator::Now() << std::endl;
-            }
-            sim_delay_file.close();
-        }
-        if (p4_switch_ID == 2) {
-            int64_t src_pkt_id = -1;
-            if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_1).get_uint64();
-            } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_2).get_uint64();
-            } else {
-                std::cout << "tag set from ns3 -> bmv2 recover failed." << std::endl;
-            }
-
-            std::string filename = "./scratch-data/p4-codel/sim_in_queue_2.csv";
-            std::ofstream sim_delay_file(filename, std::ios::app);
-            if (sim_delay_file.is_open()) {
-                sim_delay_file << "SimQIn," << src_pkt_id << "," << Simulator::Now() << std::endl;
-            }
-            sim_delay_file.close();
-        }
+    // the length is what a byte rate charges to the queue token bucket
+    size_t bytes = packet->get_register(RegisterAccess::PACKET_LENGTH_REG_IDX);
+    uint64_t rank = m_fields.pifo_rank.present ? m_fields.pifo_rank.get(phv).get_uint64() : 0u;
+    int64_t src_pkt_id = packet->get_packet_id();
+    bm::Packet* queued = packet.get();  // still alive: egress runs from the scheduler
+    int pushed;
+    {
+        // the packet is counted once, when it leaves the egress queue
+        P4StageTimer timer(m_profiler.get(), P4_STAGE_QUEUE, false);
+        pushed = egress_buffers.push_front(
+            egress_port, nb_queues_per_port - 1 - priority, bytes, rank,
+            std::move(packet));
     }
+    if (pushed == 0) {
+        // the queue is full, the packet has not been taken
+        release_context(packet.get());
+        return;
+    }
+    size_t depth = egress_buffers.size(egress_port, nb_queues_per_port - 1 - priority);
+    QueueHistograms& histograms = queue_histograms(egress_port, priority);
+    histograms.occupancy.record(depth);
+    histograms.size.record(bytes);
+    trace_pipeline(m_enqueueTrace, queued, egress_port, depth);
+    ScheduleEgress(egress_port);
+
+    trace_packet(P4_TRACE_QUEUE_IN, src_pkt_id, nullptr);
 }
 
 // used for ingress cloning, resubmit
@@ -836,7 +1317,32 @@ void P4Model::copy_field_list_and_set_type(
     phv_copy->reset_metadata();
     FieldList* field_list = this->get_field_list(field_list_id);
     field_list->copy_fields_between_phvs(phv_copy, packet->get_phv());
-    phv_copy->get_field("standard_metadata.instance_type").set(copy_type);
+    m_fields.instance_type.get(phv_copy).set(copy_type);
+}
+
+/**
+ * @brief Get \p packet ready for another pass of the pipeline, as the new
+ * copy of resubmit and recirculate used to be: the headers are invalid,
+ * the metadata is reset but the fields of \p field_list_id keep their
+ * values, and the instance type is \p type.
+ */
+void P4Model::reset_phv_keep_field_list(bm::Packet* packet,
+    PktInstanceType type, p4object_id_t field_list_id)
+{
+    PHV* phv = packet->get_phv();
+    FieldList* field_list = this->get_field_list(field_list_id);
+    m_fieldListValues.clear();
+    for (const auto& field : *field_list) {
+        m_fieldListValues.push_back(phv->get_field(field.header, field.offset));
+    }
+    phv->reset();
+    phv->reset_header_stacks();
+    phv->reset_metadata();
+    size_t i = 0;
+    for (const auto& field : *field_list) {
+        phv->get_field(field.header, field.offset).set(m_fieldListValues[i++]);
+    }
+    m_fields.instance_type.get(phv).set(type);
 }
 
 void P4Model::check_queueing_metadata()
@@ -858,24 +1364,155 @@ void P4Model::check_queueing_metadata()
     with_queueing_metadata = false;
 }
 
-void P4Model::multicast(bm::Packet* packet, unsigned int mgid)
+/**
+ * @brief Resolve the PHV fields used per packet, for the P4 program which
+ * has just been loaded (or swapped in).
+ */
+void P4Model::resolve_field_handles()
+{
+    // every PHV of a program has the same layout, a probe packet gives one
+    std::unique_ptr<bm::Packet> probe = new_packet_ptr(0, 0, 0, bm::PacketBuffer(0));
+    PHV* phv = probe->get_phv();
+    auto resolve = [phv](const std::string& name) {
+        FieldHandle handle;
+        size_t dot = name.find('.');
+        if (dot != std::string::npos && phv->has_field(name)) {
+            const bm::Header& header = phv->get_header(name.substr(0, dot));
+            handle.header = header.get_id();
+            handle.offset = header.get_header_type().get_field_offset(name.substr(dot + 1));
+            handle.present = true;
+        }
+        return handle;
+    };
+    // the ns3i metadata of the program, by field name without the number
+    // the compiler appended (e.g. "userMetadata._ns3i_protocol3" -> "protocol")
+    std::unordered_map<std::string, FieldHandle> ns3i_fields;
+    for (auto header = phv->header_begin(); header != phv->header_end(); ++header) {
+        const bm::HeaderType& type = header->get_header_type();
+        for (int offset = 0; offset < type.get_num_fields(); offset++) {
+            const std::string& name = type.get_field_name(offset);
+            size_t begin = name.find("_ns3i_");
+            size_t end = name.find_last_not_of("0123456789") + 1;
+            if (begin == std::string::npos || end <= begin + 6) {
+                continue;
+            }
+            FieldHandle& handle = ns3i_fields[name.substr(begin + 6, end - begin - 6)];
+            if (!handle.present) {
+                handle.header = header->get_id();
+                handle.offset = offset;
+                handle.present = true;
+            }
+        }
+    }
+    // the names set in P4GlobalVar come first, then the discovered field
+    auto resolve_ns3 = [&](const std::string& name_1, const std::string& name_2,
+                           const std::string& key) {
+        FieldHandle handle = resolve(name_1);
+        if (!handle.present) {
+            handle = resolve(name_2);
+        }
+        if (!handle.present) {
+            auto found = ns3i_fields.find(key);
+            if (found != ns3i_fields.end()) {
+                handle = found->second;
+            } else {
+                bm::Logger::get()->warn("The P4 program has no ns3i {} field", key);
+            }
+        }
+        return handle;
+    };
+
+    m_fields.ingress_port = resolve("standard_metadata.ingress_port");
+    m_fields.packet_length = resolve("standard_metadata.packet_length");
+    m_fields.instance_type = resolve("standard_metadata.instance_type");
+    m_fields.egress_spec = resolve("standard_metadata.egress_spec");
+    m_fields.egress_port = resolve("standard_metadata.egress_port");
+    m_fields.std_priority = resolve("standard_metadata.priority");
+    m_fields.parser_error = resolve("standard_metadata.parser_error");
+    m_fields.checksum_error = resolve("standard_metadata.checksum_error");
+    m_fields.ingress_global_timestamp = resolve("intrinsic_metadata.ingress_global_timestamp");
+    m_fields.egress_global_timestamp = resolve("intrinsic_metadata.egress_global_timestamp");
+    m_fields.mcast_grp = resolve("intrinsic_metadata.mcast_grp");
+    m_fields.egress_rid = resolve("intrinsic_metadata.egress_rid");
+    m_fields.enq_timestamp = resolve("queueing_metadata.enq_timestamp");
+    m_fields.enq_qdepth = resolve("queueing_metadata.enq_qdepth");
+    m_fields.deq_timedelta = resolve("queueing_metadata.deq_timedelta");
+    m_fields.deq_qdepth = resolve("queueing_metadata.deq_qdepth");
+    m_fields.qid = resolve("queueing_metadata.qid");
+    m_fields.queueing_priority = resolve(SSWITCH_PRIORITY_QUEUEING_SRC);
+    m_fields.pifo_rank = resolve(m_pifoRankField);
+    m_fields.ns3_protocol = resolve_ns3(P4GlobalVar::ns3i_protocol_1,
+        P4GlobalVar::ns3i_protocol_2, "protocol");
+    m_fields.ns3_destination = resolve_ns3(P4GlobalVar::ns3i_destination_1,
+        P4GlobalVar::ns3i_destination_2, "destination");
+    m_fields.ns3_pkts_id = resolve_ns3(P4GlobalVar::ns3i_pkts_id_1,
+        P4GlobalVar::ns3i_pkts_id_2, "pkts_id");
+
+    // the probe keeps the parsed headers for the ingress clones
+    m_parsedHeaders = std::move(probe);
+}
+
+/**
+ * @brief Every ingress clone used to parse the packet again. When the
+ * packets are cloned often enough, the headers are copied after the parser
+ * instead, and a clone takes them from there: a copy of the valid headers
+ * per packet is cheaper than a parse per clone above one clone in
+ * m_cloneSnapshotRatio packets ("CloneSnapshotRatio" attribute, the
+ * default depends on the parser and the headers of the program). The clone
+ * ratio is measured per window of kCloneSnapshotWindow ingress packets.
+ */
+static const uint64_t kCloneSnapshotWindow = 1024;
+
+void P4Model::update_clone_snapshot(bool cloned)
+{
+    m_cloneWindowClones += cloned ? 1 : 0;
+    if (++m_cloneWindowPackets == kCloneSnapshotWindow) {
+        m_snapshotParsedHeaders = m_cloneSnapshotRatio != 0
+            && m_cloneWindowClones * m_cloneSnapshotRatio >= kCloneSnapshotWindow;
+        m_cloneWindowPackets = 0;
+        m_cloneWindowClones = 0;
+    }
+}
+
+/**
+ * @brief A copy of \p packet (bytes and PHV) sharing its context.
+ */
+std::unique_ptr<bm::Packet> P4Model::clone_with_context(bm::Packet* packet)
+{
+    std::unique_ptr<bm::Packet> packet_copy = packet->clone_with_phv_ptr();
+    tracing_bm_packets_created++;
+    acquire_context(packet_copy.get());
+    return packet_copy;
+}
+
+/**
+ * @brief Enqueue one replica of \p packet per output of multicast group
+ * \p mgid. The packet itself is the last replica, so a group of N outputs
+ * costs N - 1 copies (none for a single output).
+ */
+void P4Model::multicast(std::unique_ptr<bm::Packet>&& packet, unsigned int mgid)
 {
     auto* phv = packet->get_phv();
-    auto& f_rid = phv->get_field("intrinsic_metadata.egress_rid");
+    auto& f_rid = m_fields.egress_rid.get(phv);
     const auto pre_out = pre->replicate({ mgid });
     auto packet_size = packet->get_register(RegisterAccess::PACKET_LENGTH_REG_IDX);
-    for (const auto& out : pre_out) {
-        auto egress_port = out.egress_port;
+    for (size_t i = 0; i < pre_out.size(); i++) {
+        auto egress_port = pre_out[i].egress_port;
 #ifdef BMNANOMSG_ON
         BMLOG_DEBUG_PKT(*packet, "Replicating packet on port {}", egress_port);
 #endif
-        f_rid.set(out.rid);
-        std::unique_ptr<bm::Packet> packet_copy = packet->clone_with_phv_ptr();
+        f_rid.set(pre_out[i].rid);
+        std::unique_ptr<bm::Packet> packet_copy = (i + 1 < pre_out.size())
+            ? clone_with_context(packet.get())
+            : std::move(packet);
         RegisterAccess::clear_all(packet_copy.get());
         packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
             packet_size);
         enqueue(egress_port, std::move(packet_copy));
     }
+    if (packet) { // empty group
+        release_context(packet.get());
+    }
 }
 
 void P4Model::ingress_thread()
@@ -883,7 +1520,10 @@ void P4Model::ingress_thread()
     PHV* phv;
 
     std::unique_ptr<bm::Packet> packet;
-    input_buffer->pop_back(&packet);
+    {
+        P4StageTimer timer(m_profiler.get(), P4_STAGE_QUEUE, false);
+        input_buffer->pop_back(&packet);
+    }
     if (packet == nullptr)
         return;
 
@@ -913,22 +1553,41 @@ void P4Model::ingress_thread()
         parser leave the buffer unchanged, and move the pop logic to the
         deparser. TODO? */
     const bm::Packet::buffer_state_t packet_in_state = packet->save_buffer_state();
-    parser->parse(packet.get());
+    {
+        P4StageTimer timer(m_profiler.get(), P4_STAGE_PARSE);
+        parser->parse(packet.get());
+    }
+
+    // the ingress clones of this packet take the parsed headers from here,
+    // see update_clone_snapshot
+    const bool parsed_snapshot = m_snapshotParsedHeaders;
+    if (parsed_snapshot) {
+        m_parsedHeaders->get_phv()->copy_headers(*phv);
+        // as well as the outcome of the parser, which a parse of the clone
+        // would set again
+        m_parsedHeaders->set_error_code(packet->get_error_code());
+        m_parsedHeaders->set_checksum_error(packet->get_checksum_error());
+    }
 
-    if (phv->has_field("standard_metadata.parser_error")) {
-        phv->get_field("standard_metadata.parser_error").set(packet->get_error_code().get());
+    if (m_fields.parser_error.present) {
+        m_fields.parser_error.get(phv).set(packet->get_error_code().get());
     }
 
-    if (phv->has_field("standard_metadata.checksum_error")) {
-        phv->get_field("standard_metadata.checksum_error").set(packet->get_checksum_error() ? 1 : 0);
+    if (m_fields.checksum_error.present) {
+        m_fields.checksum_error.get(phv).set(packet->get_checksum_error() ? 1 : 0);
     }
 
-    ingress_mau->apply(packet.get());
+    {
+        P4StageTimer timer(m_profiler.get(), P4_STAGE_INGRESS);
+        P4TableStatsScope tables(m_tableStats.get());
+        ingress_mau->apply(packet.get());
+    }
 
     packet->reset_exit();
 
-    Field& f_egress_spec = phv->get_field("standard_metadata.egress_spec");
+    Field& f_egress_spec = m_fields.egress_spec.get(phv);
     port_t egress_spec = f_egress_spec.get_uint();
+    trace_pipeline(m_ingressTrace, packet.get(), egress_spec);
 
     auto clone_mirror_session_id = RegisterAccess::get_clone_mirror_session_id(packet.get());
     auto clone_field_list = RegisterAccess::get_clone_field_list(packet.get());
@@ -938,11 +1597,13 @@ void P4Model::ingress_thread()
 
     // detect mcast support, if this is true we assume that other fields needed
     // for mcast are also defined
-    if (phv->has_field("intrinsic_metadata.mcast_grp")) {
-        Field& f_mgid = phv->get_field("intrinsic_metadata.mcast_grp");
+    if (m_fields.mcast_grp.present) {
+        Field& f_mgid = m_fields.mcast_grp.get(phv);
         mgid = f_mgid.get_uint();
     }
 
+    update_clone_snapshot(clone_mirror_session_id != 0);
+
     // INGRESS CLONING
     if (clone_mirror_session_id) {
 #ifdef BMNANOMSG_ON
@@ -958,24 +1619,40 @@ void P4Model::ingress_thread()
             static_cast<mirror_id_t>(clone_mirror_session_id), &config);
         if (is_session_configured) {
             const bm::Packet::buffer_state_t packet_out_state = packet->save_buffer_state();
-            packet->restore_buffer_state(packet_in_state);
+            if (!parsed_snapshot) {
+                packet->restore_buffer_state(packet_in_state);
+            }
             p4object_id_t field_list_id = clone_field_list;
             std::unique_ptr<bm::Packet> packet_copy = packet->clone_no_phv_ptr();
+            tracing_bm_packets_created++;
+            acquire_context(packet_copy.get());
             RegisterAccess::clear_all(packet_copy.get());
             packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
                 ingress_packet_size);
-            // we need to parse again
-            // the alternative would be to pay the (huge) price of PHV copy for
-            // every ingress packet
-            parser->parse(packet_copy.get());
+            if (parsed_snapshot) {
+                // the copy is past the parsed headers like the packet, it
+                // gets the headers as they were after the parser
+                packet_copy->get_phv()->copy_headers(*m_parsedHeaders->get_phv());
+                packet_copy->set_error_code(m_parsedHeaders->get_error_code());
+                packet_copy->set_checksum_error(m_parsedHeaders->get_checksum_error());
+            } else {
+                // we need to parse again, the PHV copy is only paid for every
+                // ingress packet when clones are frequent
+                parser->parse(packet_copy.get());
+            }
             copy_field_list_and_set_type(packet, packet_copy,
                 PKT_INSTANCE_TYPE_INGRESS_CLONE,
                 field_list_id);
+            trace_pipeline(m_cloneTrace, packet_copy.get(), config.egress_port);
             if (config.mgid_valid) {
 #ifdef BMNANOMSG_ON
                 BMLOG_DEBUG_PKT(*packet, "Cloning packet to MGID {}", config.mgid);
 #endif
-                multicast(packet_copy.get(), config.mgid);
+                // the clone is the last replica, unless it also goes to a port
+                multicast(config.egress_port_valid
+                        ? clone_with_context(packet_copy.get())
+                        : std::move(packet_copy),
+                    config.mgid);
             }
             if (config.egress_port_valid) {
 #ifdef BMNANOMSG_ON
@@ -983,6 +1660,8 @@ void P4Model::ingress_thread()
                     config.egress_port);
 #endif
                 enqueue(config.egress_port, std::move(packet_copy));
+            } else if (packet_copy) {
+                release_context(packet_copy.get());
             }
             packet->restore_buffer_state(packet_out_state);
         }
@@ -1004,20 +1683,19 @@ void P4Model::ingress_thread()
         packet->restore_buffer_state(packet_in_state);
         p4object_id_t field_list_id = resubmit_flag;
         RegisterAccess::set_resubmit_flag(packet.get(), 0);
-        // TODO(antonin): a copy is not needed here, but I don't yet have an
-        // optimized way of doing this
-        std::unique_ptr<bm::Packet> packet_copy = packet->clone_no_phv_ptr();
-        PHV* phv_copy = packet_copy->get_phv();
-        copy_field_list_and_set_type(packet, packet_copy,
-            PKT_INSTANCE_TYPE_RESUBMIT,
+        // the packet itself goes back, no copy
+        reset_phv_keep_field_list(packet.get(), PKT_INSTANCE_TYPE_RESUBMIT,
             field_list_id);
-        RegisterAccess::clear_all(packet_copy.get());
-        packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
+        RegisterAccess::clear_all(packet.get());
+        packet->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
             ingress_packet_size);
-        phv_copy->get_field("standard_metadata.packet_length")
+        m_fields.packet_length.get(phv)
             .set(ingress_packet_size);
-        input_buffer->push_front(
-            InputBuffer::PacketType::RESUBMIT, std::move(packet_copy));
+        trace_pipeline(m_resubmitTrace, packet.get(), egress_spec);
+        if (input_buffer->push_front(
+                InputBuffer::PacketType::RESUBMIT, std::move(packet)) == 0) {
+            release_context(packet.get());
+        }
         return;
     }
 
@@ -1026,10 +1704,10 @@ void P4Model::ingress_thread()
 #ifdef BMNANOMSG_ON
         BMLOG_DEBUG_PKT(*packet, "Multicast requested for packet");
 #endif
-        auto& f_instance_type = phv->get_field("standard_metadata.instance_type");
+        auto& f_instance_type = m_fields.instance_type.get(phv);
         f_instance_type.set(PKT_INSTANCE_TYPE_REPLICATION);
-        multicast(packet.get(), mgid);
-        // when doing multicast, we discard the original packet
+        // the packet is the last of its replicas
+        multicast(std::move(packet), mgid);
         return;
     }
 
@@ -1039,39 +1717,37 @@ void P4Model::ingress_thread()
 #endif
     if (egress_port == drop_port) { // drop packet
         tracing_ingress_drop++;
+        trace_pipeline(m_ingressDropTrace, packet.get(), egress_port);
+        release_context(packet.get());
 #ifdef BMNANOMSG_ON
         BMLOG_DEBUG_PKT(*packet, "Dropping packet at the end of ingress");
 #endif
         return;
     }
-    auto& f_instance_type = phv->get_field("standard_metadata.instance_type");
+    auto& f_instance_type = m_fields.instance_type.get(phv);
     f_instance_type.set(PKT_INSTANCE_TYPE_NORMAL);
 
     enqueue(egress_port, std::move(packet));
 }
 
-void P4Model::egress_thread(size_t worker_id)
+void P4Model::egress_thread(port_t port)
 {
     PHV* phv;
 
     std::unique_ptr<bm::Packet> packet;
-    size_t port;
     size_t priority;
 
-    bool none_flag = true;
-    int queue_number = default_nb_queues_per_port;
-    for (int i = 0; i < queue_number; i++) {
-        if (egress_buffers.size(i) > 0) {
-            none_flag = false;
-            break;
-        }
-    }
-    if (none_flag) {
-        return;
+    // nothing is popped if no packet of this port is allowed to leave yet
+    Time arrival;
+    uint64_t queue_start = m_profiler ? P4StageProfiler::ticks() : 0;
+    egress_buffers.pop_back_queue(port, &priority, &packet, &arrival);
+    if (m_profiler) {
+        m_profiler->add(P4_STAGE_QUEUE, queue_start, packet != nullptr);
     }
-    egress_buffers.pop_back(worker_id, &port, &priority, &packet);
     if (packet == nullptr)
         return;
+    queue_histograms(port, nb_queues_per_port - 1 - priority)
+        .sojourn.record((m_burstClock.now() - arrival).GetNanoSeconds());
 
     tracing_egress_total_pkts++;
 
@@ -1080,80 +1756,37 @@ void P4Model::egress_thread(size_t worker_id)
 
     phv = packet->get_phv();
 
-    if (P4GlobalVar::ns3_p4_tracing_dalay_sim) {
-        if (p4_switch_ID == 1) {
-            int priority = -1;
-            PHV* phv = packet->get_phv();
-            if (phv->has_field("standard_metadata.priority")) {
-                priority = phv->get_field("standard_metadata.priority").get_int();
-            }
-
-            int64_t src_pkt_id = -1;
-            if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_1).get_uint64();
-            } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_2).get_uint64();
-            } else {
-                std::cout << "tag set from ns3 -> bmv2 recover failed." << std::endl;
-            }
-
-            std::string filename = "./scratch-data/p4-codel/sim_out_queue_1.csv";
-            std::ofstream sim_delay_file(filename, std::ios::app);
-            if (sim_delay_file.is_open()) {
-                sim_delay_file << "SimQOut," << src_pkt_id << "," << priority << 
-                                "," << Simulator::Now() << std::endl;
-            }
-            sim_delay_file.close();
-        }
-        if (p4_switch_ID == 2) {
-            int priority = -1;
-            PHV* phv = packet->get_phv();
-            if (phv->has_field("standard_metadata.priority")) {
-                priority = phv->get_field("standard_metadata.priority").get_int();
-            }
-
-            int64_t src_pkt_id = -1;
-            if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_1).get_uint64();
-            } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-                src_pkt_id = phv->get_field(P4GlobalVar::ns3i_pkts_id_2).get_uint64();
-            } else {
-                std::cout << "tag set from ns3 -> bmv2 recover failed." << std::endl;
-            }
-
-            std::string filename = "./scratch-data/p4-codel/sim_out_queue_2.csv";
-            std::ofstream sim_delay_file(filename, std::ios::app);
-            if (sim_delay_file.is_open()) {
-                sim_delay_file << "SimQOut," << src_pkt_id << "," << priority << 
-                                "," << Simulator::Now() << std::endl;
-            }
-            sim_delay_file.close();
-        }
-    }
-    if (phv->has_field("intrinsic_metadata.egress_global_timestamp")) {
-        phv->get_field("intrinsic_metadata.egress_global_timestamp")
-            .set(Simulator::Now().GetMicroSeconds());
+    trace_packet(P4_TRACE_QUEUE_OUT, packet->get_packet_id(), phv);
+    trace_pipeline(m_dequeueTrace, packet.get(), port, egress_buffers.size(port, priority));
+    if (m_fields.egress_global_timestamp.present) {
+        m_fields.egress_global_timestamp.get(phv)
+            .set(m_burstClock.now().GetMicroSeconds());
     }
 
     if (with_queueing_metadata) {
-        uint64_t enq_timestamp = phv->get_field("queueing_metadata.enq_timestamp").get<uint64_t>();
-        uint64_t now = Simulator::Now().GetMicroSeconds();
-        phv->get_field("queueing_metadata.deq_timedelta").set(now - enq_timestamp);
-        phv->get_field("queueing_metadata.deq_qdepth").set(egress_buffers.size(port));
-        if (phv->has_field("queueing_metadata.qid")) {
-            auto& qid_f = phv->get_field("queueing_metadata.qid");
+        uint64_t enq_timestamp = m_fields.enq_timestamp.get(phv).get<uint64_t>();
+        uint64_t now = m_burstClock.now().GetMicroSeconds();
+        // the packet may have been enqueued late in a longer ingress burst
+        m_fields.deq_timedelta.get(phv).set(now > enq_timestamp ? now - enq_timestamp : 0);
+        m_fields.deq_qdepth.get(phv).set(egress_buffers.size(port));
+        if (m_fields.qid.present) {
+            auto& qid_f = m_fields.qid.get(phv);
             qid_f.set(nb_queues_per_port - 1 - priority);
         }
     }
 
-    phv->get_field("standard_metadata.egress_port").set(port);
+    m_fields.egress_port.get(phv).set(port);
 
-    Field& f_egress_spec = phv->get_field("standard_metadata.egress_spec");
+    Field& f_egress_spec = m_fields.egress_spec.get(phv);
     f_egress_spec.set(0);
 
-    phv->get_field("standard_metadata.packet_length").set(packet->get_register(RegisterAccess::PACKET_LENGTH_REG_IDX));
+    m_fields.packet_length.get(phv).set(packet->get_register(RegisterAccess::PACKET_LENGTH_REG_IDX));
 
-    egress_mau->apply(packet.get());
+    {
+        P4StageTimer timer(m_profiler.get(), P4_STAGE_EGRESS);
+        P4TableStatsScope tables(m_tableStats.get());
+        egress_mau->apply(packet.get());
+    }
 
     auto clone_mirror_session_id = RegisterAccess::get_clone_mirror_session_id(packet.get());
     auto clone_field_list = RegisterAccess::get_clone_field_list(packet.get());
@@ -1174,20 +1807,27 @@ void P4Model::egress_thread(size_t worker_id)
         if (is_session_configured) {
             p4object_id_t field_list_id = clone_field_list;
             std::unique_ptr<bm::Packet> packet_copy = packet->clone_with_phv_reset_metadata_ptr();
+            tracing_bm_packets_created++;
+            acquire_context(packet_copy.get());
             PHV* phv_copy = packet_copy->get_phv();
             FieldList* field_list = this->get_field_list(field_list_id);
             field_list->copy_fields_between_phvs(phv_copy, phv);
-            phv_copy->get_field("standard_metadata.instance_type")
+            m_fields.instance_type.get(phv_copy)
                 .set(PKT_INSTANCE_TYPE_EGRESS_CLONE);
             auto packet_size = packet->get_register(RegisterAccess::PACKET_LENGTH_REG_IDX);
             RegisterAccess::clear_all(packet_copy.get());
             packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
                 packet_size);
+            trace_pipeline(m_cloneTrace, packet_copy.get(), config.egress_port);
             if (config.mgid_valid) {
 #ifdef BMNANOMSG_ON
                 BMLOG_DEBUG_PKT(*packet, "Cloning packet to MGID {}", config.mgid);
 #endif
-                multicast(packet_copy.get(), config.mgid);
+                // the clone is the last replica, unless it also goes to a port
+                multicast(config.egress_port_valid
+                        ? clone_with_context(packet_copy.get())
+                        : std::move(packet_copy),
+                    config.mgid);
             }
             if (config.egress_port_valid) {
 #ifdef BMNANOMSG_ON
@@ -1195,6 +1835,8 @@ void P4Model::egress_thread(size_t worker_id)
                     config.egress_port);
 #endif
                 enqueue(config.egress_port, std::move(packet_copy));
+            } else if (packet_copy) {
+                release_context(packet_copy.get());
             }
         }
     }
@@ -1203,13 +1845,18 @@ void P4Model::egress_thread(size_t worker_id)
     port_t egress_spec = f_egress_spec.get_uint();
     if (egress_spec == drop_port) { // drop packet
         tracing_egress_drop++;
+        trace_pipeline(m_egressDropTrace, packet.get(), packet->get_egress_port());
+        release_context(packet.get());
 #ifdef BMNANOMSG_ON
         BMLOG_DEBUG_PKT(*packet, "Dropping packet at the end of egress");
 #endif
         return;
     }
 
-    deparser->deparse(packet.get());
+    {
+        P4StageTimer timer(m_profiler.get(), P4_STAGE_DEPARSE);
+        deparser->deparse(packet.get());
+    }
 
     // RECIRCULATE
     auto recirculate_flag = RegisterAccess::get_recirculate_flag(packet.get());
@@ -1219,28 +1866,27 @@ void P4Model::egress_thread(size_t worker_id)
 #endif
         p4object_id_t field_list_id = recirculate_flag;
         RegisterAccess::set_recirculate_flag(packet.get(), 0);
-        FieldList* field_list = this->get_field_list(field_list_id);
-        // TODO(antonin): just like for resubmit, there is no need for a copy
-        // here, but it is more convenient for this first prototype
-        std::unique_ptr<bm::Packet> packet_copy = packet->clone_no_phv_ptr();
-        PHV* phv_copy = packet_copy->get_phv();
-        phv_copy->reset_metadata();
-        field_list->copy_fields_between_phvs(phv_copy, phv);
-        phv_copy->get_field("standard_metadata.instance_type")
-            .set(PKT_INSTANCE_TYPE_RECIRC);
-        size_t packet_size = packet_copy->get_data_size();
-        RegisterAccess::clear_all(packet_copy.get());
-        packet_copy->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
+        // the deparsed packet itself goes back, no copy
+        reset_phv_keep_field_list(packet.get(), PKT_INSTANCE_TYPE_RECIRC,
+            field_list_id);
+        size_t packet_size = packet->get_data_size() + shared_payload_size(packet.get());
+        RegisterAccess::clear_all(packet.get());
+        packet->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX,
             packet_size);
-        phv_copy->get_field("standard_metadata.packet_length").set(packet_size);
-        // TODO(antonin): really it may be better to create a new packet here or
-        // to fold this functionality into the Packet class?
-        packet_copy->set_ingress_length(packet_size);
-        input_buffer->push_front(
-            InputBuffer::PacketType::RECIRCULATE, std::move(packet_copy));
+        m_fields.packet_length.get(phv).set(packet_size);
+        packet->set_ingress_length(packet_size);
+        trace_pipeline(m_recirculateTrace, packet.get(), packet->get_egress_port());
+        if (input_buffer->push_front(
+                InputBuffer::PacketType::RECIRCULATE, std::move(packet)) == 0) {
+            release_context(packet.get());
+        }
         return;
     }
 
+    if (HasPipelineLatency()) {
+        EnterPipelineLine(m_egressLine, GetEgressLatency(), std::move(packet));
+        return;
+    }
     output_buffer.push_front(std::move(packet));
 }
 
@@ -1248,26 +1894,22 @@ int P4Model::ReceivePacket(Ptr<ns3::Packet> packetIn, int inPort,
     uint16_t protocol, Address const& destination)
 {
     // **************Change ns3::Packet to bm::Packet***************************
+    // the packet buffer has room for all the headers the deparser may add,
+    // see size_packet_headroom. The bytes are serialized straight into the
+    // end of the bm::PacketBuffer (as its copy constructor would place them),
+    // so there is one copy and no temporary buffer.
+    // Past m_payloadOffset the bytes stay in packetIn, see size_payload_split.
+    uint64_t receive_start = m_profiler ? P4StageProfiler::ticks() : 0;
     int ns3Length = packetIn->GetSize();
-    uint8_t* ns3Buffer = new uint8_t[ns3Length];
-    packetIn->CopyData(ns3Buffer, ns3Length);
-
-    if (P4GlobalVar::ns3_p4_tracing_dalay_ByteTag) {
-        // parse the ByteTag in ns3::packet (for tracing delay etc)
-        DelayJitterEstimationTimestampTag djtag;
-        if (packetIn->FindFirstMatchingByteTag(djtag)) {
-            m_tag_queue_mutex.lock();
-            tag_map.insert(std::pair<int64_t, DelayJitterEstimationTimestampTag>(m_pktID, djtag));
-            m_tag_queue_mutex.unlock();
-        }
-    }
+    int headLength = (m_payloadOffset != 0 && ns3Length > int(m_payloadOffset))
+        ? int(m_payloadOffset) : ns3Length;
+    bm::PacketBuffer pktBuffer(headLength + m_packetHeadroom);
+    packetIn->CopyData(reinterpret_cast<uint8_t*>(pktBuffer.push(headLength)), headLength);
 
-    // we limit the packet buffer to original size + 512 bytes, which means we
-    // cannot add more than 512 bytes of header data to the packet, which should
-    // be more than enough
+    packet_id++;
     std::unique_ptr<bm::Packet> packet = new_packet_ptr(inPort, m_pktID++,
-        ns3Length, bm::PacketBuffer(ns3Length + 512, (char*)ns3Buffer, ns3Length));
-    delete[] ns3Buffer;
+        ns3Length, std::move(pktBuffer));
+    tracing_bm_packets_created++;
 
 #ifdef BMNANOMSG_ON
     BMELOG(packet_in, *packet);
@@ -1278,7 +1920,7 @@ int P4Model::ReceivePacket(Ptr<ns3::Packet> packetIn, int inPort,
 
         PHV* phv = packet->get_phv();
 
-        int len = packet.get()->get_data_size();
+        int len = ns3Length;
         packet.get()->set_ingress_port(inPort);
 
         // many current P4 programs assume this
@@ -1287,121 +1929,195 @@ int P4Model::ReceivePacket(Ptr<ns3::Packet> packetIn, int inPort,
         RegisterAccess::clear_all(packet.get());
 
         // setting standard metadata
-        phv->get_field("standard_metadata.ingress_port").set(inPort);
+        m_fields.ingress_port.get(phv).set(inPort);
         // using packet register 0 to store length, this register will be updated for
         // each add_header / remove_header primitive call
         packet->set_register(RegisterAccess::PACKET_LENGTH_REG_IDX, len);
-        phv->get_field("standard_metadata.packet_length").set(len);
-        Field& f_instance_type = phv->get_field("standard_metadata.instance_type");
+        m_fields.packet_length.get(phv).set(len);
+        Field& f_instance_type = m_fields.instance_type.get(phv);
         f_instance_type.set(PKT_INSTANCE_TYPE_NORMAL);
 
-        if (phv->has_field("intrinsic_metadata.ingress_global_timestamp")) {
-            phv->get_field("intrinsic_metadata.ingress_global_timestamp")
+        if (m_fields.ingress_global_timestamp.present) {
+            m_fields.ingress_global_timestamp.get(phv)
                 .set(Simulator::Now().GetMicroSeconds());
         }
 
-        /* ==========================new====================================================
-        Record the ns3::protocol, ns3::destinatio into bm::packet, this is
-        useful, because after the 3 buffers and Ingress Egress loops, or resubmit/
-        recirculaiton etc, maybe bm::packet will get a different order. So I think
-        this situation can only be solved by adding additional information to
-        the bm::package. @mingyu
-        */
-
-        //==========================protocol==========================
-        if (phv->has_field(P4GlobalVar::ns3i_protocol_1)) {
-            phv->get_field(P4GlobalVar::ns3i_protocol_1).set(protocol);
-        } else if (phv->has_field(P4GlobalVar::ns3i_protocol_2)) {
-            phv->get_field(P4GlobalVar::ns3i_protocol_2).set(protocol);
-        } else {
-            std::cout << "protocol set from ns3 -> bmv2 failed." << std::endl;
-        }
-
         // ==========================address==========================
-        int index_dest_address = 0;
-        if (std::find(destination_list.begin(), destination_list.end(), destination) == destination_list.end()) {
-            destination_list.push_back(destination);
-            index_dest_address = destination_list.size() - 1;
-        } else {
-            auto it = std::find(destination_list.begin(), destination_list.end(), destination);
-            index_dest_address = std::distance(destination_list.begin(), it);
+        uint32_t index_dest_address = P4GlobalVar::g_addressTable.Intern(destination);
+
+        // ==========================context==========================
+        // the protocol, the destination and the tags of packetIn stay in the
+        // switch, shared by all the copies of the packet (same packet id),
+        // the P4 program does not need to carry them in its metadata
+        uint64_t growths = m_contexts.growths();
+        PacketContext* slot = m_contexts.insert(packet->get_packet_id());
+        if (slot == nullptr) {
+            NS_FATAL_ERROR("Switch " << p4_switch_ID << ": " << m_contexts.size()
+                << " packet contexts in use, more than " << m_contexts.max_capacity()
+                << " (packets never sent nor dropped?)");
         }
-
-        if (phv->has_field(P4GlobalVar::ns3i_destination_1)) {
-            phv->get_field(P4GlobalVar::ns3i_destination_1)
-                .set(index_dest_address);
-        } else if (phv->has_field(P4GlobalVar::ns3i_destination_2)) {
-            phv->get_field(P4GlobalVar::ns3i_destination_2)
-                .set(index_dest_address);
-        } else {
-            // warning
-            std::cout << "destination address set from ns3 -> bmv2 failed." << std::endl;
+        if (m_contexts.growths() != growths) {
+            bm::Logger::get()->info("Packet contexts of switch {} grown to {} slots",
+                p4_switch_ID, m_contexts.capacity());
         }
-
-        // ==========================packet id==========================
-        if (phv->has_field(P4GlobalVar::ns3i_pkts_id_1)) {
-            phv->get_field(P4GlobalVar::ns3i_pkts_id_1).set(m_pktID - 1);
-        } else if (phv->has_field(P4GlobalVar::ns3i_pkts_id_2)) {
-            phv->get_field(P4GlobalVar::ns3i_pkts_id_2).set(m_pktID - 1);
-        } else {
-            std::cout << "tag set from ns3 -> bmv2 failed." << std::endl;
+        PacketContext& context = *slot;
+        context.protocol = protocol;
+        context.destination = index_dest_address;
+        context.ingressTime = Simulator::Now();
+        // the bytes of packetIn are not used any more, but its byte and
+        // packet tags go to the ns3::packet sent at egress
+        if (packetIn->GetByteTagIterator().HasNext()
+                || packetIn->GetPacketTagIterator().HasNext()) {
+            context.tags = packetIn;
+        }
+        // the payload shares the buffer of packetIn, the tags come from above
+        if (headLength < ns3Length) {
+            Ptr<ns3::Packet> payload = packetIn->CreateFragment(headLength,
+                ns3Length - headLength);
+            payload->RemoveAllByteTags();
+            payload->RemoveAllPacketTags();
+            context.payload = payload;
         }
 
-        input_buffer->push_front(
-            InputBuffer::PacketType::NORMAL, std::move(packet));
+        // programs written for the ns3i metadata may still read it
+        if (m_fields.ns3_protocol.present) {
+            m_fields.ns3_protocol.get(phv).set(protocol);
+        }
+        if (m_fields.ns3_destination.present) {
+            m_fields.ns3_destination.get(phv).set(index_dest_address);
+        }
+        if (m_fields.ns3_pkts_id.present) {
+            m_fields.ns3_pkts_id.get(phv).set(packet->get_packet_id());
+        }
+        if (m_profiler) {
+            m_profiler->add(P4_STAGE_RECEIVE, receive_start);
+        }
 
-        if (P4GlobalVar::ns3_p4_tracing_dalay_sim) {
-            if (p4_switch_ID == 1) {
-                std::string filename = "./scratch-data/p4-codel/sim_delay_in_switch_1.csv";
-                std::ofstream sim_delay_file(filename, std::ios::app);
-                if (sim_delay_file.is_open()) {
-                    sim_delay_file << "SimIn," << m_pktID - 1 << "," << Simulator::Now() << std::endl;
-                }
-                sim_delay_file.close();
-            }
-            if (p4_switch_ID == 2) {
-                std::string filename = "./scratch-data/p4-codel/sim_delay_in_switch_2.csv";
-                std::ofstream sim_delay_file(filename, std::ios::app);
-                if (sim_delay_file.is_open()) {
-                    sim_delay_file << "SimIn," << m_pktID - 1 << "," << Simulator::Now() << std::endl;
-                }
-                sim_delay_file.close();
+        if (HasPipelineLatency()) {
+            EnterPipelineLine(m_ingressLine, GetIngressLatency(), std::move(packet));
+        } else {
+            if (input_buffer->push_front(
+                    InputBuffer::PacketType::NORMAL, std::move(packet)) == 0) {
+                release_context(packet.get());
             }
+            ScheduleIngress();
         }
 
+        trace_packet(P4_TRACE_SWITCH_IN, m_pktID - 1, nullptr);
+
         return 0;
     }
     return -1;
 }
 
+/**
+ * @brief The polling timers charge the per-packet service time for every
+ * packet handled during one burst, so the next event comes after
+ * \p processed periods (at least one period when idle). Packet i of the
+ * burst is at Now + i periods (see P4BurstClock).
+ */
+static Time ChargeServiceTime(const Time& per_packet, size_t processed)
+{
+    return TimeStep(per_packet.GetTimeStep() * std::max<size_t>(processed, 1));
+}
+
+/**
+ * @brief Run up to m_burstSize packets through the ingress part, each one
+ * \p per_packet after the previous one.
+ * @return the number of packets taken from the input buffer
+ */
+size_t P4Model::ingress_burst(const Time& per_packet)
+{
+    size_t processed = 0;
+    m_burstClock.start(per_packet);
+    while (processed < m_burstSize && input_buffer->size() > 0) {
+        this->ingress_thread();
+        processed++;
+        m_burstClock.advance();
+    }
+    m_burstClock.stop();
+    return processed;
+}
+
+/**
+ * @brief Run up to m_burstSize packets, which are already allowed to
+ * leave the egress queues of \p port, through the egress part, each one
+ * \p per_packet after the previous one.
+ * @return the number of packets taken from the egress queues
+ */
+size_t P4Model::egress_burst(port_t port, const Time& per_packet)
+{
+    size_t processed = 0;
+    Time next_departure;
+    m_burstClock.start(per_packet);
+    while (processed < m_burstSize
+        && egress_buffers.get_queue_next_departure(port, &next_departure)
+        && next_departure <= Simulator::Now()) {
+        this->egress_thread(port);
+        processed++;
+        m_burstClock.advance();
+    }
+    m_burstClock.stop();
+    return processed;
+}
+
+/**
+ * @brief Send up to m_burstSize packets from the output buffer, each one
+ * \p per_packet after the previous one.
+ * @return the number of packets transmitted
+ */
+size_t P4Model::transmit_burst(const Time& per_packet)
+{
+    size_t processed = 0;
+    m_burstClock.start(per_packet);
+    while (processed < m_burstSize && output_buffer.size() > 0) {
+        this->transmit_thread();
+        processed++;
+        m_burstClock.advance();
+    }
+    m_burstClock.stop();
+    return processed;
+}
+
 /**
  * @brief Schedule the ingress part to run, and schedule 
  * the next timer event with loops.
  */
 void P4Model::RunIngressTimerEvent()
 {
+    if (m_schedulingMode == EVENT_DRIVEN_SCHEDULE) {
+        this->ingress_burst(Time(0));
+        ScheduleIngress();
+        return;
+    }
+
+    size_t processed = 0;
     size_t size = input_buffer->get_size();
+    // Reschedule timer event @todo: change the time
+    Time period = (size > 10) ? Time("100us") : Time("1ms");
     if (size > 0) {
-        this->ingress_thread();
-    }
-    if (size > 10) {
-        // Reschedule timer event @todo: change the time
-        m_ingressTimerEvent = Simulator::Schedule(Time("100us"), &P4Model::RunIngressTimerEvent, this);
-    } else {
-        // Reschedule timer event
-        m_ingressTimerEvent = Simulator::Schedule(Time("1ms"), &P4Model::RunIngressTimerEvent, this);
+        processed = this->ingress_burst(period);
     }
+    m_ingressTimerEvent = Simulator::Schedule(ChargeServiceTime(period, processed),
+        &P4Model::RunIngressTimerEvent, this);
 }
 
 /**
- * @brief Schedule the egress part to run, and schedule 
- * the next timer event with loops.
+ * @brief Run the egress part for the packets of \p port which may leave
+ * now, then arm the next departure of this port. The port stays busy for
+ * the service time of the packets it has just served.
  */
-void P4Model::RunEgressTimerEvent()
+void P4Model::RunEgressPortEvent(port_t port)
 {
-    this->egress_thread(worker_id);
-    // Reschedule timer event
-    m_egressTimerEvent = Simulator::Schedule(m_egressTimeReference, &P4Model::RunEgressTimerEvent, this);
+    // with the stage latency model the egress stages set the pace instead
+    Time service_time = HasPipelineLatency() ? Time(0) : m_egressServiceTime;
+    size_t processed = this->egress_burst(port, service_time);
+    m_egressPorts[port].nextFree = Simulator::Now()
+        + TimeStep(service_time.GetTimeStep() * processed);
+    // recirculated packets go back to ingress (clones are armed by enqueue)
+    ScheduleIngress();
+    ScheduleEgress(port);
+    ScheduleTransmit();
 }
 
 /**
@@ -1410,9 +2126,272 @@ void P4Model::RunEgressTimerEvent()
  */
 void P4Model::RunTransmitTimerEvent()
 {
-    this->transmit_thread();
+    if (m_schedulingMode == EVENT_DRIVEN_SCHEDULE) {
+        this->transmit_burst(Time(0));
+        ScheduleTransmit();
+        return;
+    }
+
+    size_t processed = this->transmit_burst(m_transmitTimeReference);
     // Reschedule timer event
-    m_transmitTimerEvent = Simulator::Schedule(m_transmitTimeReference, &P4Model::RunTransmitTimerEvent, this);
+    m_transmitTimerEvent = Simulator::Schedule(ChargeServiceTime(m_transmitTimeReference, processed),
+        &P4Model::RunTransmitTimerEvent, this);
+}
+
+/**
+ * @brief With event driven scheduling, run the ingress part right away
+ * if some packets are waiting in the input buffer.
+ */
+void P4Model::ScheduleIngress()
+{
+    if (m_schedulingMode != EVENT_DRIVEN_SCHEDULE || m_ingressTimerEvent.IsRunning()) {
+        return;
+    }
+    if (input_buffer->size() > 0) {
+        m_ingressTimerEvent = Simulator::ScheduleNow(&P4Model::RunIngressTimerEvent, this);
+    }
+}
+
+/**
+ * @brief Run the egress part of \p port at the departure time of its next
+ * packet, but not before the port has finished serving the previous ones.
+ * An event already armed for another time is moved. Used by both
+ * scheduling modes, so idle ports never schedule anything.
+ */
+void P4Model::ScheduleEgress(port_t port)
+{
+    Time next_departure;
+    if (!egress_buffers.get_queue_next_departure(port, &next_departure)) {
+        return;
+    }
+    if (port >= m_egressPorts.size()) {
+        m_egressPorts.resize(port + 1);
+    }
+    EgressPortClock& portClock = m_egressPorts[port];
+    Time now = Simulator::Now();
+    next_departure = std::max(next_departure, std::max(now, portClock.nextFree));
+    if (portClock.event.IsRunning()) {
+        // an earlier event would serve the port while it is still busy
+        if (portClock.event.GetTs() == static_cast<uint64_t>(next_departure.GetTimeStep())) {
+            return;
+        }
+        portClock.event.Cancel();
+    }
+    portClock.event = Simulator::Schedule(next_departure - now,
+        &P4Model::RunEgressPortEvent, this, port);
+}
+
+/**
+ * @brief With event driven scheduling, run the transmit part right away
+ * if some packets are waiting in the output buffer.
+ */
+void P4Model::ScheduleTransmit()
+{
+    if (m_schedulingMode != EVENT_DRIVEN_SCHEDULE || m_transmitTimerEvent.IsRunning()) {
+        return;
+    }
+    if (output_buffer.size() > 0) {
+        m_transmitTimerEvent = Simulator::ScheduleNow(&P4Model::RunTransmitTimerEvent, this);
+    }
+}
+
+bool P4Model::HasPipelineLatency() const
+{
+    return !m_parserLatency.IsZero() || !m_mauStageLatency.IsZero()
+        || !m_deparserLatency.IsZero() || !m_trafficManagerLatency.IsZero();
+}
+
+/**
+ * @brief The stages are pipelined, so a part of the pipeline takes a new
+ * packet once its slowest stage is free: this bounds the throughput.
+ */
+Time P4Model::GetStageInterval() const
+{
+    return std::max(m_parserLatency, std::max(m_mauStageLatency, m_deparserLatency));
+}
+
+Time P4Model::GetIngressLatency() const
+{
+    size_t stages = m_ingressMauStages ? m_ingressMauStages : m_ingressTables;
+    return m_parserLatency + TimeStep(m_mauStageLatency.GetTimeStep() * stages)
+        + m_trafficManagerLatency;
+}
+
+Time P4Model::GetEgressLatency() const
+{
+    size_t stages = m_egressMauStages ? m_egressMauStages : m_egressTables;
+    return TimeStep(m_mauStageLatency.GetTimeStep() * stages) + m_deparserLatency;
+}
+
+/**
+ * @brief Let \p packet enter the first stage of \p line as soon as the
+ * stage is free, it leaves the line \p latency later.
+ */
+void P4Model::EnterPipelineLine(PipelineLine& line, Time latency,
+    std::unique_ptr<bm::Packet>&& packet)
+{
+    Time now = Simulator::Now();
+    Time entry = std::max(now, line.nextIssue);
+    line.nextIssue = entry + GetStageInterval();
+    line.packets.push_back(std::make_pair(entry + latency, std::move(packet)));
+    if (!line.event.IsRunning()) {
+        line.event = Simulator::Schedule(line.packets.front().first - now,
+            (&line == &m_ingressLine) ? &P4Model::RunIngressLineEvent
+                                      : &P4Model::RunEgressLineEvent,
+            this);
+    }
+}
+
+/**
+ * @brief The packets which have crossed the parser, the ingress stages and
+ * the traffic manager run through ingress now (the stage latencies already
+ * account for its time, in both scheduling modes).
+ */
+void P4Model::RunIngressLineEvent()
+{
+    Time now = Simulator::Now();
+    while (!m_ingressLine.packets.empty() && m_ingressLine.packets.front().first <= now) {
+        std::unique_ptr<bm::Packet>& packet = m_ingressLine.packets.front().second;
+        if (input_buffer->push_front(InputBuffer::PacketType::NORMAL,
+                std::move(packet)) == 0) {
+            release_context(packet.get());
+        }
+        m_ingressLine.packets.pop_front();
+        this->ingress_thread();
+    }
+    if (!m_ingressLine.packets.empty()) {
+        m_ingressLine.event = Simulator::Schedule(m_ingressLine.packets.front().first - now,
+            &P4Model::RunIngressLineEvent, this);
+    }
+    ScheduleIngress();
+}
+
+/**
+ * @brief The packets which have crossed the egress stages and the deparser
+ * are transmitted now.
+ */
+void P4Model::RunEgressLineEvent()
+{
+    Time now = Simulator::Now();
+    while (!m_egressLine.packets.empty() && m_egressLine.packets.front().first <= now) {
+        output_buffer.push_front(std::move(m_egressLine.packets.front().second));
+        m_egressLine.packets.pop_front();
+        this->transmit_thread();
+    }
+    if (!m_egressLine.packets.empty()) {
+        m_egressLine.event = Simulator::Schedule(m_egressLine.packets.front().first - now,
+            &P4Model::RunEgressLineEvent, this);
+    }
+}
+
+/**
+ * @brief Count the tables of the ingress and egress pipelines of the loaded
+ * P4 program, by default every table is one match-action stage.
+ */
+void P4Model::count_pipeline_tables(const Json::Value& config)
+{
+    m_ingressTables = CountP4PipelineTables(config, "ingress");
+    m_egressTables = CountP4PipelineTables(config, "egress");
+}
+
+/**
+ * @brief With P4GlobalVar::ns3_p4_tracing_dalay_sim, the per-packet events
+ * of every switch go to its binary trace file in
+ * P4GlobalVar::ns3_p4_tracing_dir (see examples/p4-trace-to-csv.py), which
+ * is complete after Simulator::Destroy.
+ */
+void P4Model::open_trace_sink()
+{
+    if (!P4GlobalVar::ns3_p4_tracing_dalay_sim || m_traceSink) {
+        return;
+    }
+    std::string path = P4GlobalVar::ns3_p4_tracing_dir + "p4-trace-switch-"
+        + std::to_string(p4_switch_ID) + ".bin";
+    m_traceSink.reset(new P4TraceSink(path));
+    if (!m_traceSink->IsOpen()) {
+        bm::Logger::get()->warn("Cannot open the trace file {}", path);
+        m_traceSink.reset();
+        return;
+    }
+    m_traceCloseEvent = Simulator::ScheduleDestroy(&P4TraceSink::Close, m_traceSink.get());
+}
+
+void P4Model::trace_packet(P4TraceEvent event, int64_t packet_id, PHV* phv)
+{
+    if (!m_traceSink) {
+        return;
+    }
+    int64_t priority = -1;
+    if (phv != nullptr && m_fields.std_priority.present) {
+        priority = m_fields.std_priority.get(phv).get_int();
+    }
+    m_traceSink->Record(event, p4_switch_ID, m_burstClock.now().GetNanoSeconds(),
+        packet_id, priority);
+}
+
+/**
+ * @brief Fire \p trace for \p packet. Nothing is read from the packet when
+ * the trace source has no sink.
+ */
+void P4Model::trace_pipeline(const PipelineTrace& trace, bm::Packet* packet,
+    port_t egress_port, size_t queue_depth)
+{
+    if (trace.IsEmpty()) {
+        return;
+    }
+    P4PipelineEvent event;
+    event.packetId = packet->get_packet_id();
+    event.ingressPort = packet->get_ingress_port();
+    event.egressPort = egress_port;
+    event.priority = -1;
+    if (m_fields.std_priority.present) {
+        event.priority = m_fields.std_priority.get(packet->get_phv()).get_int();
+    }
+    event.queueDepth = queue_depth;
+    const PacketContext* context = m_contexts.find(packet->get_packet_id());
+    event.ingressTime = context ? context->ingressTime : Time();
+    event.time = m_burstClock.now();
+    trace(event);
+}
+
+/**
+ * @brief The parser of the loaded P4 program cannot reach past its header
+ * bytes, so with "SharePayload" a received packet only copies these bytes
+ * into its bm packet (at least an Ethernet header, which the net device
+ * strips at egress). The rest is a fragment of the received ns3::Packet,
+ * which all the copies of the packet share (the ns-3 buffer is copy on
+ * write) and which is appended again at transmit. A program with a
+ * checksum over the payload or the truncate primitive gets all the bytes.
+ */
+void P4Model::size_payload_split(const Json::Value& config)
+{
+    if (!m_sharePayload || P4ProgramReadsPayload(config)) {
+        m_payloadOffset = 0;
+        return;
+    }
+    m_payloadOffset = std::max<size_t>(CountP4HeaderBytes(config),
+        EthernetHeader().GetSerializedSize());
+}
+
+/**
+ * @brief Bytes of \p packet kept in its context instead of its buffer.
+ */
+uint32_t P4Model::shared_payload_size(bm::Packet* packet)
+{
+    const PacketContext* context = m_contexts.find(packet->get_packet_id());
+    return (context && context->payload) ? context->payload->GetSize() : 0;
+}
+
+/**
+ * @brief Size the room left in front of a received packet from the headers
+ * the deparser of the loaded P4 program may emit: the parser takes the
+ * parsed headers out of the buffer and the deparser puts back at most
+ * these bytes. Without a deparser in the JSON the former 512 bytes stay.
+ */
+void P4Model::size_packet_headroom(const Json::Value& config)
+{
+    size_t deparser_bytes = CountP4DeparserBytes(config);
+    m_packetHeadroom = deparser_bytes ? deparser_bytes : 512;
 }
 
 /**
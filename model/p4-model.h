@@ -31,11 +31,21 @@
 #include "ns3/string.h"
 #include "ns3/integer.h"
 #include "ns3/uinteger.h"
+#include "ns3/boolean.h"
 #include "ns3/traced-value.h"
+#include "ns3/traced-callback.h"
 #include "ns3/delay-jitter-estimation.h"
 #include "ns3/event-id.h"
 #include "ns3/nstime.h"
 #include "ns3/simulator.h"
+#include "ns3/p4-burst-clock.h"
+#include "ns3/p4-histogram.h"
+#include "ns3/p4-packet-context.h"
+#include "ns3/p4-queue-policy.h"
+#include "ns3/p4-stage-profiler.h"
+#include "ns3/p4-table-stats.h"
+#include "ns3/p4-trace-sink.h"
+#include "ns3/p4-queueing-logic.h"
 #include <bm/bm_sim/queue.h>
 #include <bm/bm_sim/queueing.h>
 #include <bm/bm_sim/packet.h>
@@ -45,15 +55,18 @@
 #include <bm/bm_sim/parser.h>
 #include <bm/bm_sim/tables.h>
 #include <fstream>
+#include <ostream>
 #include <mutex>
 #include <memory>
 #include <vector>
 #include <chrono>
 #include <functional>
+#include <unordered_map>
 #include "ns3/p4-controller.h"
 #include "ns3/p4-net-device.h"
 
 #define SSWITCH_PRIORITY_QUEUEING_SRC "intrinsic_metadata.priority"
+#define P4_PIFO_RANK_SRC "intrinsic_metadata.rank"
 
 using ts_res = std::chrono::microseconds;
 using std::chrono::duration_cast;
@@ -72,497 +85,25 @@ using bm::FieldList;
 using bm::packet_id_t;
 using bm::p4object_id_t;
 
+namespace Json {
+class Value;
+}
+
 namespace ns3 {
 class P4NetDevice;
 
-
 /**
- * @brief A simple priority queueing logic for ns-3 p4simulator.
- * 
- * [from bmv2 author]
- * This class is slightly more advanced than QueueingLogicRL. The difference
- * between the 2 is that this one offers the ability to set several priority
- * queues for each logical queue. Priority queues are numbered from `0` to
- * `nb_priorities` (see NSQueueingLogicPriRL::NSQueueingLogicPriRL()). Priority `0`
- * is the highest priority queue. Each priority queue can have its own rate and
- * its own capacity. Queues will be served in order of priority, until their
- * respective maximum rate is reached. If no maximum rate is set, queues with a
- * high priority can starve lower-priority queues. For example, if the queue
- * with priority `0` always contains at least one element, the other queues
- * will never be served.
- * As for QueueingLogicRL, the write behavior (push_front()) is not blocking:
- * once a logical queue is full, subsequent incoming elements will be dropped
- * until the queue starts draining again.
- * Look at the documentation for QueueingLogic for more information about the
- * template parameters (they are the same).
- * 
- * @tparam T 
- * @tparam FMap 
+ * @brief What the pipeline trace sources of a P4Model ("Ingress",
+ * "Transmit"...) report about one packet.
  */
-template <typename T, typename FMap>
-class NSQueueingLogicPriRL {
-  using MutexType = std::mutex;
-  using LockType = std::unique_lock<MutexType>;
-
- public:
-  
-  /**
-   * @brief Construct a new NSQueueingLogicPriRL object\
-   * 
-   * See QueueingLogic::QueueingLogicRL() for an introduction. The difference
-   * here is that each logical queue can receive several priority queues (as
-   * determined by \p nb_priorities, which is set to `2` by default). Each of
-   * these priority queues will initially be able to hold \p capacity
-   * elements. The capacity of each priority queue can be changed later by
-   * using set_capacity(size_t queue_id, size_t priority, size_t c).
-   * 
-   * @param nb_workers 
-   * @param capacity 
-   * @param map_to_worker 
-   * @param nb_priorities 
-   */
-  NSQueueingLogicPriRL(size_t nb_workers, size_t capacity,
-                     FMap map_to_worker, size_t nb_priorities = 2)
-      : nb_workers(nb_workers),
-        capacity(capacity),
-        workers_info(nb_workers),
-        map_to_worker(std::move(map_to_worker)),
-        nb_priorities(nb_priorities) { }
-
-  /**
-   * @brief Place the packet in the front of corresponding priority queue.
-   * If priority queue \p priority of logical queue \p queue_id is full, the
-   * function will return `0` immediately. Otherwise, \p item will be copied to
-   * the queue and the function will return `1`. If \p queue_id or \p priority
-   * are incorrect, an exception of type std::out_of_range will be thrown (same
-   * if the FMap object provided to the constructor does not behave correctly).
-   * 
-   * @param queue_id each egress port will have a queue_id
-   * @param priority the priroity of the packet in one queue
-   * @param item the packet or things to be placed in the queue
-   * @return int 
-   */
-  int push_front(size_t queue_id, size_t priority, const T &item) {
-    size_t worker_id = map_to_worker(queue_id);
-    LockType lock(mutex);
-    auto &q_info = get_queue(queue_id);
-    auto &w_info = workers_info.at(worker_id);
-    auto &q_info_pri = q_info.at(priority);
-    if (q_info_pri.size >= q_info_pri.capacity) return 0;
-    q_info_pri.last_sent = get_next_tp(q_info_pri);
-    w_info.queues[priority].emplace(
-        item, queue_id, q_info_pri.last_sent, w_info.wrapping_counter++);
-    q_info_pri.size++;
-    q_info.size++;
-    w_info.size++;
-    w_info.q_not_empty.notify_one();
-    return 1;
-  }
-
-  /**
-   * @brief  Place the packet in the queue. The state is priority queue not 
-   * enabled.
-   * 
-   * @param queue_id each egress port will have a queue_id
-   * @param item the packet or things to be placed in the queue
-   * @return int 
-   */
-  int push_front(size_t queue_id, const T &item) {
-    return push_front(queue_id, 0, item);
-  }
-
-  //! Same as push_front(size_t queue_id, size_t priority, const T &item), but
-  //! \p item is moved instead of copied.
-  int push_front(size_t queue_id, size_t priority, T &&item) {
-    size_t worker_id = map_to_worker(queue_id);
-    LockType lock(mutex);
-    auto &q_info = get_queue(queue_id);
-    auto &w_info = workers_info.at(worker_id);
-    auto &q_info_pri = q_info.at(priority);
-    if (q_info_pri.size >= q_info_pri.capacity) return 0;
-    q_info_pri.last_sent = get_next_tp(q_info_pri);
-    w_info.queues[priority].emplace(
-        std::move(item),
-        queue_id,
-        q_info_pri.last_sent,
-        w_info.wrapping_counter++);
-    q_info_pri.size++;
-    q_info.size++;
-    w_info.size++;
-    w_info.q_not_empty.notify_one();
-    return 1;
-  }
-
-  int push_front(size_t queue_id, T &&item) {
-    return push_front(queue_id, 0, std::move(item));
-  }
-
-  
-  /**
-   * @brief The exit end of the priority queue is prioritized. (itself bmv2 code 
-   * through the lock mechanism, but ns-3 does not have a built-in locking 
-   * mechanism ns3 in the replacement for the polling mechanism, so there will
-   * be some loss in performance)
-   * 
-   * [from bmv2 author]
-   * Retrieves an element for the worker thread indentified by \p worker_id and
-   * moves it to \p pItem. The id of the logical queue which contained this
-   * element is copied to \p queue_id and the priority value of the served
-   * queue is copied to \p priority.
-   * Elements are retrieved according to the priority queue they are in
-   * (highest priorities, i.e. lowest priority values, are served first). Once
-   * a given priority queue reaches its maximum rate, the next queue is served.
-   * If no elements are available (either the queues are empty or they have
-   * exceeded their rate already), the function will block.
-   * 
-   * @ todo remove the lock mechanism, also the loops in the function
-   * 
-   * @param worker_id 
-   * @param queue_id 
-   * @param priority 
-   * @param pItem 
-   */
-  void pop_back(size_t worker_id, size_t *queue_id, size_t *priority,
-                T *pItem) {
-    LockType lock(mutex);
-    auto &w_info = workers_info.at(worker_id);
-    MyQ *queue = nullptr;
-    size_t pri;
-    while (true) {
-      if (w_info.size == 0) {
-          // w_info.q_not_empty.wait(lock); // Empty queue, wait until lock state changes (add pkts)
-          // will take out the null, but leave the detection step to a later process
-          return;
-      } else {
-		    // There's a pkt in the queue.
-        Time now = Simulator::Now();
-        Time next = now + Seconds (10); // set 10s as the max interval for one packet process.
-        for (pri = 0; pri < nb_priorities; pri++) {
-          auto &q = w_info.queues[pri];
-          if (q.size() == 0) continue;
-          if (q.top().send <= now) {
-            queue = &q;
-            break;
-          }
-          next = (next < q.top().send) ? next : q.top().send;
-        }
-        if (queue) break;
-        // At this point the queue is empty again, waiting for the lock state to change (add pkts)
-		    // Null will be taken out, but the detection step is left to a later process
-        return;
-      }
-    }
-    *queue_id = queue->top().queue_id;
-    *priority = pri;
-    // TODO(antonin): improve / document this
-    // http://stackoverflow.com/questions/20149471/move-out-element-of-std-priority-queue-in-c11
-    *pItem = std::move(const_cast<QE &>(queue->top()).e);
-    queue->pop();
-    auto &q_info = get_queue_or_throw(*queue_id);
-    auto &q_info_pri = q_info.at(*priority);
-    q_info_pri.size--;
-    q_info.size--;
-    w_info.size--;
-  }
-
-  /**
-   * @brief 
-   * Same as
-   * pop_back(size_t worker_id, size_t *queue_id, size_t *priority, T *pItem),
-   * but the priority of the popped element is discarded.
-   * 
-   * @param worker_id from bmv2 thread id, in ns-3 we only one, so ignore it
-   * @param queue_id the queue_id in each egress port
-   * @param pItem the packet or things to be pop out from queue
-   */
-  void pop_back(size_t worker_id, size_t *queue_id, T *pItem) {
-    size_t priority;
-    return pop_back(worker_id, queue_id, &priority, pItem);
-  }
-
-  /**
-   * @brief  QueueingLogic::size
-   * @copydoc QueueingLogic::size
-   * The occupancies of all the priority queues for this logical queue are 
-   * added.
-   * @param queue_id the queue_id of logical queue in each egress port
-   * @return size_t 
-   */
-  size_t size(size_t queue_id) const {
-    LockType lock(mutex);
-    auto it = queues_info.find(queue_id);
-    if (it == queues_info.end()) return 0;
-    auto &q_info = it->second;
-    return q_info.size;
-  }
-
-  /**
-   * @brief Get the occupancy of priority queue \p priority for logical 
-   * queue with id \p queue_id.
-   * 
-   * @param queue_id the id of logical queue in each egress port
-   * @param priority the prirority of the packet in one logical queue 
-   * with \p queue_id
-   * @return size_t 
-   */
-  size_t size(size_t queue_id, size_t priority) const {
-    LockType lock(mutex);
-    auto it = queues_info.find(queue_id);
-    if (it == queues_info.end()) return 0;
-    auto &q_info = it->second;
-    auto &q_info_pri = q_info.at(priority);
-    return q_info_pri.size;
-  }
-
-  /**
-   * @brief Set the capacity of all the priority queues for logical 
-   * queue \p queue_id to \p c elements.
-   * 
-   * @param queue_id the id of logical queue in each egress port
-   * @param c number of packets in queue
-   */
-  void set_capacity(size_t queue_id, size_t c) {
-    LockType lock(mutex);
-    for_each_q(queue_id, SetCapacityFn(c));
-  }
-
-  /**
-   * @brief Set the capacity of priority queue with \p priority for 
-   * logical queue \p queue_id to \p c elements.
-   * 
-   * @param queue_id the id of logical queue in each egress port
-   * @param priority the \p priority number of one logical queue
-   * @param c number of packets in one priority queue
-   */
-  void set_capacity(size_t queue_id, size_t priority, size_t c) {
-    LockType lock(mutex);
-    for_one_q(queue_id, priority, SetCapacityFn(c));
-  }
-
-  /**
-   * @brief Set the capacity of all the priority queues of all 
-   * logical queues to \p c elements.
-   * 
-   * @param c number of packets in one priority queue
-   */
-  void set_capacity_for_all(size_t c) {
-    LockType lock(mutex);
-    for (auto &p : queues_info) for_each_q(p.first, SetCapacityFn(c));
-    capacity = c;
-  }
-
-  //! Set the maximum rate of all the priority queues for logical queue \p
-  //! queue_id to \p pps. \p pps is expressed in "number of elements per
-  //! second". Until this function is called, there will be no rate limit for
-  //! the queue. The same behavior (no rate limit) can be achieved by calling
-  //! this method with a rate of 0.
-
-  /**
-   * @brief Set the rate of processing packets
-   * Set the maximum rate of all the priority queues for logical queue \p
-   * queue_id to \p pps. \p pps is expressed in "number of elements per
-   * second". Until this function is called, there will be no rate limit for
-   * the queue. The same behavior (no rate limit) can be achieved by calling
-   * this method with a rate of 0.
-   * 
-   * @param queue_id the id of logical queue in each egress port
-   * @param pps packets per second
-   */
-  void set_rate(size_t queue_id, uint64_t pps) {
-    LockType lock(mutex);
-    for_each_q(queue_id, SetRateFn(pps));
-  }
-
-  /**
-   * @brief Set the rate object
-   * Same as set_rate(size_t queue_id, uint64_t pps) but only applies 
-   * to the given priority queue.
-   * @param queue_id the id of logical queue in each egress port
-   * @param priority the prirority of the packet in one logical queue 
-   * @param pps packets per second
-   */
-  void set_rate(size_t queue_id, size_t priority, uint64_t pps) {
-    LockType lock(mutex);
-    for_one_q(queue_id, priority, SetRateFn(pps));
-  }
-
-  /**
-   * @brief Set the rate of all the priority queues of all logical 
-   * queues to \p pps.
-   * 
-   * @param pps 
-   */
-  void set_rate_for_all(uint64_t pps) {
-    LockType lock(mutex);
-    for (auto &p : queues_info) for_each_q(p.first, SetRateFn(pps));
-    queue_rate_pps = pps;
-  }
-
-  //! Deleted copy constructor
-  NSQueueingLogicPriRL(const NSQueueingLogicPriRL &) = delete;
-  //! Deleted copy assignment operator
-  NSQueueingLogicPriRL &operator =(const NSQueueingLogicPriRL &) = delete;
-
-  //! Deleted move constructor
-  NSQueueingLogicPriRL(NSQueueingLogicPriRL &&) = delete;
-  //! Deleted move assignment operator
-  NSQueueingLogicPriRL &&operator =(NSQueueingLogicPriRL &&) = delete;
-
- private:
-  
-  /**
-   * @brief calculate the intermediate time interval for processing
-   * one packet. 1 pps = 1 packet per second,  default is 1ms for 
-   * one packet. pps should not set to 0.
-   * 
-   * @param pps 
-   * @return constexpr Time 
-   */
-  static constexpr Time rate_to_time(uint64_t pps) {
-    
-    return (pps == 0) ?
-        Seconds (0.001) : Seconds (static_cast<double>(1. / static_cast<double>(pps)));
-  }
-
-  /**
-   * @brief The control label of the packet, the queue it is in, 
-   * the timestamp, etc.
-   */
-  struct QE {
-    QE(T e, size_t queue_id, const Time &send, size_t id)
-        : e(std::move(e)), queue_id(queue_id), send(send), id(id) { }
-
-    T e;
-    size_t queue_id;
-    Time send;
-    size_t id;
-  };
-
-  /**
-   * @brief Check if the packet meets the out-of-queue requirements
-   * 
-   */
-  struct QEComp {
-    bool operator()(const QE &lhs, const QE &rhs) const {
-      return (lhs.send == rhs.send) ? lhs.id > rhs.id : lhs.send > rhs.send;
-    }
-  };
-
-  using MyQ = std::priority_queue<QE, std::deque<QE>, QEComp>;
-
-  /**
-   * @brief information for each prioriry queue.
-   * 
-   */
-  struct QueueInfoPri {
-    QueueInfoPri(size_t capacity, uint64_t queue_rate_pps)
-        : capacity(capacity),
-          queue_rate_pps(queue_rate_pps),
-          pkt_delay_time(rate_to_time(queue_rate_pps)),
-          last_sent(Simulator::Now()) { }
-
-    size_t size{0};
-    size_t capacity;
-    uint64_t queue_rate_pps;
-    Time pkt_delay_time;
-    Time last_sent;
-  };
-
-  /**
-   * @brief information for each logical queue (containing multiple 
-   * priority queues).
-   */
-  struct QueueInfo : public std::vector<QueueInfoPri> {
-    QueueInfo(size_t capacity, uint64_t queue_rate_pps, size_t nb_priorities)
-        : std::vector<QueueInfoPri>(
-              nb_priorities, QueueInfoPri(capacity, queue_rate_pps)) { }
-
-    size_t size{0};
-  };
-  
-  /**
-   * @brief threads information from bmv2 src.
-   * 
-   */
-  struct WorkerInfo {
-    mutable std::condition_variable q_not_empty{};
-    size_t size{0};
-    std::array<MyQ, 32> queues;
-    size_t wrapping_counter{0};
-  };
-
-  QueueInfo &get_queue(size_t queue_id) {
-    auto it = queues_info.find(queue_id);
-    if (it != queues_info.end()) return it->second;
-    auto p = queues_info.emplace(
-        queue_id, QueueInfo(capacity, queue_rate_pps, nb_priorities));
-    return p.first->second;
-  }
-
-  const QueueInfo &get_queue_or_throw(size_t queue_id) const {
-    return queues_info.at(queue_id);
-  }
-
-  QueueInfo &get_queue_or_throw(size_t queue_id) {
-    return queues_info.at(queue_id);
-  }
-
-  Time get_next_tp(const  QueueInfoPri &q_info_pri) {
-    // Calculate when the next step should be sent
-    return (Simulator::Now() > q_info_pri.last_sent + q_info_pri.pkt_delay_time) ? 
-            Simulator::Now() : q_info_pri.last_sent + q_info_pri.pkt_delay_time;
-  }
-
-  template <typename Function>
-  Function for_each_q(size_t queue_id, Function fn) {
-    auto &q_info = get_queue(queue_id);
-    for (auto &q_info_pri : q_info) fn(q_info_pri);
-    return fn;
-  }
-
-  template <typename Function>
-  Function for_one_q(size_t queue_id, size_t priority, Function fn) {
-    auto &q_info = get_queue(queue_id);
-    auto &q_info_pri = q_info.at(priority);
-    fn(q_info_pri);
-    return fn;
-  }
-
-  struct SetCapacityFn {
-    explicit SetCapacityFn(size_t c)
-        : c(c) { }
-
-    void operator ()(QueueInfoPri &info) const {  // NOLINT(runtime/references)
-      info.capacity = c;
-    }
-
-    size_t c;
-  };
-
-  struct SetRateFn {
-    explicit SetRateFn(uint64_t pps)
-        : pps(pps) {
-      pkt_delay_time = rate_to_time(pps);
-    }
-
-    void operator ()(QueueInfoPri &info) const {  // NOLINT(runtime/references)
-      info.queue_rate_pps = pps;
-      info.pkt_delay_time = pkt_delay_time;
-    }
-
-    uint64_t pps;
-    Time pkt_delay_time;
-  };
-
-  mutable MutexType mutex;
-  size_t nb_workers;
-  size_t capacity;  // default capacity
-  uint64_t queue_rate_pps{0};  // default rate
-  std::unordered_map<size_t, QueueInfo> queues_info{};
-  std::vector<WorkerInfo> workers_info{};
-  std::vector<MyQ> queues{};
-  FMap map_to_worker;
-  size_t nb_priorities;
+struct P4PipelineEvent {
+	int64_t packetId;       //!< bm packet id, shared by the copies of a packet
+	uint32_t ingressPort;
+	uint32_t egressPort;    //!< egress port, or egress_spec before the queues
+	int32_t priority;       //!< standard_metadata.priority, -1 if unknown
+	uint32_t queueDepth;    //!< packets in the egress queue (Enqueue, Dequeue)
+	Time ingressTime;       //!< when the switch received the packet
+	Time time;              //!< when the event happened
 };
 
 /**
@@ -584,27 +125,35 @@ class NSQueueingLogicPriRL {
 * results loss of metadata. We are currently working on reserving 
 * the metadata.
 *
+* P4Model is an ns3::ObjectBase (it is owned by its P4Device, not reference
+* counted), so its attributes take the values of Config::SetDefault when it
+* is constructed and can be changed later with SetAttribute().
+*
+* Its trace sources report a P4PipelineEvent at every step of a packet:
+* "Ingress", "IngressDrop", "Enqueue", "Dequeue", "EgressDrop", "Resubmit",
+* "Recirculate", "Clone" and "Transmit". Nothing is built for a source
+* without sinks. P4NetDevice exposes the same names, so they can be
+* connected with Config paths such as
+* "/NodeList/N/DeviceList/D/$ns3::P4NetDevice/Transmit".
+*
 */
-class P4Model : public Switch {
+class P4Model : public Switch, public ObjectBase {
 	public:
 		// P4Model(P4NetDevice* netDevice);
 		static TypeId GetTypeId(void);
+		TypeId GetInstanceTypeId(void) const override;
 
-		std::vector<Address> destination_list;						  //!< list for address, using by index
-		int address_num;											              //!< index of address.
 		int p4_switch_ID;											              //!< the total drop packages number
-		std::map<int64_t, DelayJitterEstimationTimestampTag> tag_map;
 		
 		// time event for thread local
 		EventId m_ingressTimerEvent;              					//!< The timer event ID [Ingress]
 		Time m_ingressTimeReference;        	  					  //!< Desired time between timer event triggers
-		size_t worker_id;											              //!< worker_id = threads_id, here only one
-		EventId m_egressTimerEvent;              					  //!< The timer event ID [Egress]
-		Time m_egressTimeReference;        	  						  //!< Desired time between timer event triggers
+		Time m_egressTimeReference;        	  						  //!< Service time of one packet on one egress port (polling)
 		EventId m_transmitTimerEvent;              					//!< The timer event ID [Transfer]
 		Time m_transmitTimeReference;        	  					  //!< Desired time between timer event triggers
-
-    mutable std::mutex m_tag_queue_mutex;
+		unsigned int m_schedulingMode;                      //!< POLLING_SCHEDULE or EVENT_DRIVEN_SCHEDULE
+		size_t m_burstSize;                                 //!< Max packets handled by one timer event per stage
+		P4BurstClock m_burstClock;                          //!< Virtual time of the packet of the current burst
 
     // tracing with simple number count
 		int tracing_control_loop_num;
@@ -614,6 +163,7 @@ class P4Model : public Switch {
 		int64_t tracing_egress_drop;
 		int64_t tracing_total_in_pkts;
 		int64_t tracing_total_out_pkts;
+		int64_t tracing_bm_packets_created;                 //!< received, cloned and replicated
     
 		// from bmv2 simple-switch
 		using mirror_id_t = int;
@@ -665,7 +215,56 @@ class P4Model : public Switch {
 		int set_egress_queue_rate(size_t port, const uint64_t rate_pps);
 		int set_all_egress_queue_rates(const uint64_t rate_pps);
 
-		// returns the packet id of most recently received packet. Not thread-safe.
+		/**
+		* \brief Shape egress queues with a token bucket in bits per second,
+		* every packet is charged its length. A rate of 0 goes back to the
+		* packet rate (see NSQueueingLogicPriRL::set_rate_bps). A byte rate
+		* for all the queues replaces the per-packet egress service time of
+		* P4GlobalVar::g_switchBottleNeck.
+		*/
+		int set_egress_priority_queue_rate_bps(size_t port, size_t priority,
+												const uint64_t rate_bps, const size_t burst_bytes);
+		int set_egress_queue_rate_bps(size_t port, const uint64_t rate_bps,
+												const size_t burst_bytes);
+		int set_all_egress_queue_rates_bps(const uint64_t rate_bps, const size_t burst_bytes);
+
+		/**
+		* \brief Choose the scheduler of egress ports (strict priority, DRR,
+		* WFQ or PIFO), see NSQueueingLogicPriRL::set_scheduler. The PIFO rank
+		* is read from the "PifoRankField" metadata field at enqueue.
+		*/
+		int set_egress_scheduler(size_t port, EgressScheduler scheduler);
+		int set_all_egress_schedulers(EgressScheduler scheduler);
+		int set_egress_priority_queue_weight(size_t port, size_t priority,
+												const uint32_t weight);
+		int set_all_egress_drr_quanta(const size_t quantum_bytes);
+
+		/**
+		* \brief Set how many packets one ingress, egress or transmit event
+		* may handle (at least 1). Each packet is still charged its own
+		* service time, see P4GlobalVar::g_switchBurstSize.
+		*/
+		void set_burst_size(size_t burst_size);
+
+		/**
+		* \brief Write the histograms of every egress queue which has seen a
+		* packet: sojourn time (ns) and size (bytes) of the packets, and
+		* occupancy (packets) met by the packets at enqueue. With the
+		* "HistogramFile" attribute they are also written at Simulator::Destroy.
+		*/
+		void DumpQueueHistograms(std::ostream &os) const;
+		void ResetQueueHistograms();
+
+		/**
+		* \brief Lookups, hit ratio and CPU time ("TableTiming") of every
+		* table and calls of every action, null unless the "TableStatistics"
+		* attribute is set. They are also printed at Simulator::Destroy and
+		* start again when the P4 program is swapped.
+		*/
+		const P4TableStatistics *GetTableStatistics() const;
+
+		// returns the number of packets received by all the switches, minus
+		// one (the packet ids are per switch, see m_pktID). Not thread-safe.
 		static packet_id_t get_packet_id() {
 			return packet_id - 1;
 		}
@@ -694,8 +293,12 @@ class P4Model : public Switch {
 
 		class MirroringSessions;
 
-		class InputBuffer;
-		// template <typename T, typename FMap> class NSQueueingLogicPriRL;
+		// all the stages run on the single ns-3 scheduler thread, so the
+		// queues do not need any locking (MutexLockingPolicy otherwise)
+		using QueueLockingPolicy = NullLockingPolicy;
+
+		template <typename LockingPolicy> class InputBufferT;
+		using InputBuffer = InputBufferT<QueueLockingPolicy>;
 
 		enum PktInstanceType {
 			PKT_INSTANCE_TYPE_NORMAL,
@@ -718,15 +321,117 @@ class P4Model : public Switch {
 			size_t nb_threads;
 		};
 
+		/**
+		* @brief Departure clock of one egress port, every port drains its
+		* queues on its own event.
+		*/
+		struct EgressPortClock {
+			EventId event;                                    //!< next departure event of the port
+			Time nextFree;                                    //!< end of the service of the last packet
+		};
+
+		/**
+		* @brief Packets crossing the stages of one part of the pipeline. All
+		* of them cross the same stages, so they leave in arrival order.
+		*/
+		struct PipelineLine {
+			FifoRing<std::pair<Time, std::unique_ptr<bm::Packet>>> packets; //!< (exit time, packet)
+			EventId event;                                    //!< exit of the first packet
+			Time nextIssue;                                   //!< first stage free for the next packet
+		};
+
+		/**
+		* @brief A PHV field resolved by resolve_field_handles() when the P4
+		* program is loaded, so that no field is looked up by name per packet.
+		* \p present is false if the program does not have the field.
+		*/
+		struct FieldHandle {
+			bm::header_id_t header{0};
+			int offset{0};
+			bool present{false};
+
+			bm::Field &get(PHV *phv) const {
+				return phv->get_field(header, offset);
+			}
+		};
+
+		typedef void (*PipelineEventCallback)(const P4PipelineEvent &event);
+		typedef TracedCallback<const P4PipelineEvent &> PipelineTrace;
+
+		struct FieldHandles {
+			FieldHandle ingress_port;
+			FieldHandle packet_length;
+			FieldHandle instance_type;
+			FieldHandle egress_spec;
+			FieldHandle egress_port;
+			FieldHandle std_priority;                         //!< standard_metadata.priority
+			FieldHandle parser_error;
+			FieldHandle checksum_error;
+			FieldHandle ingress_global_timestamp;
+			FieldHandle egress_global_timestamp;
+			FieldHandle mcast_grp;
+			FieldHandle egress_rid;
+			FieldHandle enq_timestamp;
+			FieldHandle enq_qdepth;
+			FieldHandle deq_timedelta;
+			FieldHandle deq_qdepth;
+			FieldHandle qid;
+			FieldHandle queueing_priority;                    //!< SSWITCH_PRIORITY_QUEUEING_SRC
+			FieldHandle pifo_rank;                            //!< "PifoRankField" attribute
+			FieldHandle ns3_protocol;                         //!< P4GlobalVar::ns3i_protocol_1 or _2
+			FieldHandle ns3_destination;
+			FieldHandle ns3_pkts_id;
+		};
+
+		// what the switch keeps about a received ns3::Packet until all its
+		// copies are sent or dropped, indexed by the bm packet id
+		struct PacketContext {
+			uint16_t protocol{0};
+			uint32_t destination{0};                          //!< index in P4GlobalVar::g_addressTable
+			Ptr<const ns3::Packet> tags;                      //!< the received packet, if it has tags
+			Ptr<const ns3::Packet> payload;                   //!< bytes past the bm packet, if split
+			Time ingressTime;
+		};
+
 	private:
 		void ingress_thread();
-		void egress_thread(size_t worker_id);
+		void egress_thread(port_t port);
 		void transmit_thread();
 
+		size_t ingress_burst(const Time& per_packet);
+		size_t egress_burst(port_t port, const Time& per_packet);
+		size_t transmit_burst(const Time& per_packet);
+
 		void RunIngressTimerEvent ();
-		void RunEgressTimerEvent ();
+		void RunEgressPortEvent (port_t port);
 		void RunTransmitTimerEvent ();
 
+		// event driven scheduling, only arm the events when there is work
+		void ScheduleIngress ();
+		void ScheduleEgress (port_t port);
+		void ScheduleTransmit ();
+
+		// per-stage latency model, see the "ParserLatency" attribute
+		bool HasPipelineLatency () const;
+		Time GetStageInterval () const;
+		Time GetIngressLatency () const;
+		Time GetEgressLatency () const;
+		void EnterPipelineLine (PipelineLine &line, Time latency,
+								std::unique_ptr<bm::Packet> &&packet);
+		void RunIngressLineEvent ();
+		void RunEgressLineEvent ();
+		// read from the bmv2 JSON of the loaded program, parsed once per load
+		void count_pipeline_tables (const Json::Value &config);
+		void size_packet_headroom (const Json::Value &config);
+		void size_payload_split (const Json::Value &config);
+
+		// binary trace of the packets, see P4GlobalVar::ns3_p4_tracing_dalay_sim
+		void open_trace_sink ();
+		void trace_packet (P4TraceEvent event, int64_t packet_id, PHV *phv);
+		void trace_pipeline (const PipelineTrace &trace, bm::Packet *packet,
+							 port_t egress_port, size_t queue_depth = 0);
+		uint32_t shared_payload_size (bm::Packet *packet);
+
 		ts_res get_ts() const;
 
 		// TODO(antonin): switch to pass by value?
@@ -737,9 +442,25 @@ class P4Model : public Switch {
 			const std::unique_ptr<bm::Packet> &packet_copy,
 			PktInstanceType copy_type, p4object_id_t field_list_id);
 
-		void check_queueing_metadata();
+		void update_clone_snapshot(bool cloned);
+		void reset_phv_keep_field_list(bm::Packet *packet,
+			PktInstanceType type, p4object_id_t field_list_id);
 
-		void multicast(bm::Packet *packet, unsigned int mgid);
+		void check_queueing_metadata();
+		void resolve_field_handles();
+
+		// one more copy of the packet shares its context, or one is gone
+		void acquire_context(bm::Packet *packet);
+		void release_context(bm::Packet *packet);
+
+		// Allocations per packet: one bm::Packet and its buffer when it is
+		// received, one more per copy (clone, replica but the last one).
+		// The PHVs already come from the pool of the bmv2 context, and the
+		// bm::Packet can only be built by bmv2 (private constructor, buffer
+		// fixed at construction), so the switch saves copies rather than
+		// pooling packets. See tracing_bm_packets_created.
+		std::unique_ptr<bm::Packet> clone_with_context(bm::Packet *packet);
+		void multicast(std::unique_ptr<bm::Packet> &&packet, unsigned int mgid);
 	
 	private:
 		port_t drop_port;
@@ -747,7 +468,10 @@ class P4Model : public Switch {
 		// for these queues, the write operation is non-blocking and we drop the
 		// packet if the queue is full
 		size_t nb_queues_per_port;
-		NSQueueingLogicPriRL<std::unique_ptr<bm::Packet>, EgressThreadMapper> egress_buffers;
+		NSQueueingLogicPriRL<std::unique_ptr<bm::Packet>, EgressThreadMapper,
+			QueueLockingPolicy> egress_buffers;
+		std::vector<EgressPortClock> m_egressPorts;         //!< departure clocks, indexed by port
+		Time m_egressServiceTime;                           //!< charged per packet on its port
 		bm::Queue<std::unique_ptr<bm::Packet> > output_buffer;
 		TransmitFn my_transmit_fn;
 		std::shared_ptr<McSimplePreLAG> pre;
@@ -755,7 +479,104 @@ class P4Model : public Switch {
 		bool with_queueing_metadata{true};
 		std::unique_ptr<MirroringSessions> mirroring_sessions;
 
-		int64_t m_pktID = 0;								        //!< Packet ID
+		// "EgressRateBps" and "EgressBurstBytes" attributes, applied to all queues
+		void SetEgressRateBps(uint64_t rate_bps);
+		uint64_t GetEgressRateBps() const;
+		void SetEgressBurstBytes(uint32_t burst_bytes);
+		uint32_t GetEgressBurstBytes() const;
+
+		uint64_t m_egressRateBps = 0;
+		uint32_t m_egressBurstBytes = 1500;
+
+		// "EgressScheduler" and "DrrQuantumBytes" attributes, applied to all ports
+		void SetEgressScheduler(EgressScheduler scheduler);
+		EgressScheduler GetEgressScheduler() const;
+		void SetDrrQuantumBytes(uint32_t quantum_bytes);
+		uint32_t GetDrrQuantumBytes() const;
+
+		EgressScheduler m_egressScheduler = SCHED_STRICT_PRIORITY;
+		uint32_t m_drrQuantumBytes = 1500;
+		std::string m_pifoRankField = P4_PIFO_RANK_SRC;     //!< "PifoRankField" attribute
+		FieldHandles m_fields;                              //!< resolved at load and swap
+		PacketContextSlab<PacketContext> m_contexts;        //!< received packets in the switch
+
+		// "PacketContextCapacity" attribute
+		void SetPacketContextCapacity(uint32_t capacity);
+		uint32_t GetPacketContextCapacity() const;
+
+		// per egress queue histograms, see DumpQueueHistograms
+		struct QueueHistograms {
+			P4LogHistogram sojourn;                           //!< ns
+			P4LogHistogram occupancy;                         //!< packets, met at enqueue
+			P4LogHistogram size;                              //!< bytes
+		};
+		QueueHistograms &queue_histograms(port_t port, size_t priority);
+		void SetHistogramFile(std::string path);
+		std::string GetHistogramFile() const;
+		void write_histogram_file();
+
+		// port * nb_queues_per_port + priority, allocated at the first packet
+		std::vector<std::unique_ptr<QueueHistograms>> m_queueHistograms;
+		std::string m_histogramFile;                        //!< "HistogramFile" attribute
+		EventId m_histogramDumpEvent;                       //!< writes m_histogramFile at Simulator::Destroy
+
+		// "StageProfiling" attribute, see P4StageProfiler
+		void SetStageProfiling(bool enable);
+		bool GetStageProfiling() const;
+		void report_stage_profile();
+		std::unique_ptr<P4StageProfiler> m_profiler;        //!< null unless profiling
+		EventId m_profileReportEvent;                       //!< reports at Simulator::Destroy
+
+		// "TableStatistics" and "TableTiming" attributes, see GetTableStatistics
+		void SetTableStatistics(bool enable);
+		bool GetTableStatisticsEnabled() const;
+		void SetTableTiming(bool timing);
+		bool GetTableTiming() const;
+		void setup_table_statistics(const Json::Value &config);
+		void report_table_statistics();
+		bool m_tableStatsEnabled = false;
+		bool m_tableTiming = false;
+		std::unique_ptr<P4TableStatistics> m_tableStats;    //!< null unless enabled
+		EventId m_tableStatsReportEvent;                    //!< reports at Simulator::Destroy
+		std::string m_eventLoggerAddr;                      //!< of the options, the table events still go there
+
+		// stage latencies (attributes), all 0 by default: no latency model
+		Time m_parserLatency;
+		Time m_mauStageLatency;                             //!< per match-action stage
+		Time m_deparserLatency;
+		Time m_trafficManagerLatency;
+		uint32_t m_ingressMauStages = 0;                    //!< 0: one stage per ingress table
+		uint32_t m_egressMauStages = 0;                     //!< 0: one stage per egress table
+		size_t m_ingressTables = 0;                         //!< tables of the loaded program
+		size_t m_egressTables = 0;
+		size_t m_packetHeadroom = 512;                      //!< bytes the deparser may add
+		bool m_sharePayload = true;                         //!< "SharePayload" attribute
+		std::unique_ptr<P4TraceSink> m_traceSink;           //!< null without tracing
+		EventId m_traceCloseEvent;                          //!< closes the sink at Simulator::Destroy
+		size_t m_payloadOffset = 0;                         //!< 0: the bm packet has all the bytes
+		std::vector<bm::Data> m_fieldListValues;            //!< kept across a PHV reset
+
+		// parsed headers of the current ingress packet, see update_clone_snapshot
+		std::unique_ptr<bm::Packet> m_parsedHeaders;
+		bool m_snapshotParsedHeaders{false};
+		uint32_t m_cloneSnapshotRatio{10};                  //!< "CloneSnapshotRatio" attribute
+		uint64_t m_cloneWindowPackets{0};
+		uint64_t m_cloneWindowClones{0};
+		PipelineLine m_ingressLine;                         //!< parser, ingress stages and TM
+		PipelineLine m_egressLine;                          //!< egress stages and deparser
+
+		// trace sources, see P4PipelineEvent
+		PipelineTrace m_ingressTrace;
+		PipelineTrace m_ingressDropTrace;
+		PipelineTrace m_enqueueTrace;
+		PipelineTrace m_dequeueTrace;
+		PipelineTrace m_egressDropTrace;
+		PipelineTrace m_resubmitTrace;
+		PipelineTrace m_recirculateTrace;
+		PipelineTrace m_cloneTrace;
+		PipelineTrace m_transmitTrace;
+
+		int64_t m_pktID = 0;								        //!< id of the next packet of ReceivePacket and receive_
 		int64_t m_re_pktID = 0;								      //!< Receiver side Packet ID
 
 		bm::TargetParserBasic * m_argParser; 		    //!< Structure of parsers
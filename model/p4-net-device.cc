@@ -24,6 +24,7 @@
 #include "ns3/log.h"
 #include "ns3/node.h"
 #include "ns3/ethernet-header.h"
+#include "ns3/trace-source-accessor.h"
 #include "ns3/arp-l3-protocol.h"
 #include <bm/bm_sim/switch.h>
 #include <bm/bm_sim/core/primitives.h>
@@ -55,6 +56,52 @@ NS_OBJECT_ENSURE_REGISTERED(P4NetDevice);
 
 NS_LOG_COMPONENT_DEFINE("P4NetDevice");
 
+namespace {
+
+// Trace source of a P4NetDevice which is the trace source of the same name
+// of its P4Model, which Config paths cannot reach (not an ns3::Object).
+class P4ModelTraceAccessor : public TraceSourceAccessor {
+public:
+	explicit P4ModelTraceAccessor(const std::string& name) : m_name(name) {}
+
+	bool ConnectWithoutContext(ObjectBase* obj, const CallbackBase& cb) const
+	{
+		P4Model* model = GetModel(obj);
+		return model && model->TraceConnectWithoutContext(m_name, cb);
+	}
+	bool Connect(ObjectBase* obj, std::string context, const CallbackBase& cb) const
+	{
+		P4Model* model = GetModel(obj);
+		return model && model->TraceConnect(m_name, context, cb);
+	}
+	bool DisconnectWithoutContext(ObjectBase* obj, const CallbackBase& cb) const
+	{
+		P4Model* model = GetModel(obj);
+		return model && model->TraceDisconnectWithoutContext(m_name, cb);
+	}
+	bool Disconnect(ObjectBase* obj, std::string context, const CallbackBase& cb) const
+	{
+		P4Model* model = GetModel(obj);
+		return model && model->TraceDisconnect(m_name, context, cb);
+	}
+
+private:
+	static P4Model* GetModel(ObjectBase* obj)
+	{
+		P4NetDevice* device = dynamic_cast<P4NetDevice*>(obj);
+		return device ? device->GetP4Model() : nullptr;
+	}
+
+	std::string m_name;
+};
+
+Ptr<const TraceSourceAccessor> MakeP4ModelTraceAccessor(const std::string& name)
+{
+	return Ptr<const TraceSourceAccessor>(new P4ModelTraceAccessor(name), false);
+}
+
+} // namespace
+
 TypeId P4NetDevice::GetTypeId(void)
 {
 	static TypeId tid =
@@ -64,7 +111,34 @@ TypeId P4NetDevice::GetTypeId(void)
 			UintegerValue(1500),
 			MakeUintegerAccessor(&P4NetDevice::SetMtu,
 				&P4NetDevice::GetMtu),
-			MakeUintegerChecker<uint16_t>());
+			MakeUintegerChecker<uint16_t>())
+			.AddTraceSource("Ingress", "The Ingress trace source of the P4Model",
+				MakeP4ModelTraceAccessor("Ingress"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("IngressDrop", "The IngressDrop trace source of the P4Model",
+				MakeP4ModelTraceAccessor("IngressDrop"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("Enqueue", "The Enqueue trace source of the P4Model",
+				MakeP4ModelTraceAccessor("Enqueue"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("Dequeue", "The Dequeue trace source of the P4Model",
+				MakeP4ModelTraceAccessor("Dequeue"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("EgressDrop", "The EgressDrop trace source of the P4Model",
+				MakeP4ModelTraceAccessor("EgressDrop"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("Resubmit", "The Resubmit trace source of the P4Model",
+				MakeP4ModelTraceAccessor("Resubmit"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("Recirculate", "The Recirculate trace source of the P4Model",
+				MakeP4ModelTraceAccessor("Recirculate"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("Clone", "The Clone trace source of the P4Model",
+				MakeP4ModelTraceAccessor("Clone"),
+				"ns3::P4Model::PipelineEventCallback")
+			.AddTraceSource("Transmit", "The Transmit trace source of the P4Model",
+				MakeP4ModelTraceAccessor("Transmit"),
+				"ns3::P4Model::PipelineEventCallback");
 	return tid;
 }
 
@@ -150,13 +224,13 @@ void P4NetDevice::SendNs3Packet(Ptr<ns3::Packet> packetOut, int outPort,
 {
 	if (packetOut)
 	{
-		EthernetHeader eeh;
-		packetOut->RemoveHeader(eeh);
+		// packetOut is already without its Ethernet header and owned by
+		// nobody else, so it is sent as it is
 		if (outPort != 511)
 		{
 			NS_LOG_LOGIC("EgressPortNum: " << outPort);
 			Ptr<NetDevice> outNetDevice = GetBridgePort(outPort);
-			outNetDevice->Send(packetOut->Copy(), destination, protocol);
+			outNetDevice->Send(packetOut, destination, protocol);
 		}
 	}
 	else
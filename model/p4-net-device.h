@@ -97,6 +97,12 @@ namespace ns3 {
 		*/
 		bool SendPacket(Ptr<Packet> packet, Ptr<NetDevice>outDevice);
 		bool SendPacket(Ptr<Packet> packet, const Address& dest, Ptr<NetDevice>outDevice);
+
+		/**
+		* \brief Send a packet built by the P4 target out of \p outPort. The
+		* packet must not have an Ethernet header any more, the outgoing device
+		* adds its own, and it is not copied again.
+		*/
 		void SendNs3Packet(Ptr<ns3::Packet> packetOut, int outPort, uint16_t protocol, Address const &destination);
 
 		P4Model* GetP4Model();
@@ -0,0 +1,134 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_PACKET_CONTEXT_H
+#define P4_PACKET_CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * @brief Per-packet records of a switch, indexed by the bm packet id.
+ *
+ * The packet ids of a switch grow by one per received packet, so the
+ * packets in the switch have ids in a window. The slab is a ring of slots
+ * indexed by the low bits of the id: insert() and find() are one array
+ * access while the ring is larger than the window.
+ *
+ * A slot keeps the full id of its record, which is its generation: a
+ * record of an older generation never answers for a newer id. A live
+ * record is never overwritten: when a received packet finds its slot
+ * still taken (the switch holds more packets than the ring has slots),
+ * the ring doubles and the live records move to their new slots. insert()
+ * returns nullptr if the ring would have to grow past its maximum
+ * capacity, which only happens when records are never released.
+ *
+ * All the copies of a packet (clones, multicast, resubmit, recirculation)
+ * keep its packet id and share its record, which is counted: acquire() for
+ * every new copy, release() for every copy which is sent or dropped.
+ */
+template <typename T>
+class PacketContextSlab {
+ public:
+  explicit PacketContextSlab(size_t capacity = 16384,
+                             size_t max_capacity = size_t(1) << 24)
+      : slots(round_up(capacity)), limit(round_up(max_capacity)) { }
+
+  //! Create the record of \p id with one reference, growing the ring if
+  //! its slot is taken. nullptr if the ring is full at its maximum capacity.
+  T *insert(uint64_t id) {
+    while (slots[id & (slots.size() - 1)].refs != 0) {
+      if (slots.size() >= limit) return nullptr;
+      grow();
+    }
+    Slot &slot = slots[id & (slots.size() - 1)];
+    slot.id = id;
+    slot.refs = 1;
+    slot.value = T();
+    count++;
+    return &slot.value;
+  }
+
+  //! Get the record of \p id, nullptr if there is none.
+  T *find(uint64_t id) {
+    Slot &slot = slots[id & (slots.size() - 1)];
+    return (slot.refs != 0 && slot.id == id) ? &slot.value : nullptr;
+  }
+
+  //! One more copy of packet \p id shares its record, no-op without record.
+  void acquire(uint64_t id) {
+    Slot &slot = slots[id & (slots.size() - 1)];
+    if (slot.refs != 0 && slot.id == id) slot.refs++;
+  }
+
+  //! One copy of packet \p id is gone, the record goes with the last one.
+  void release(uint64_t id) {
+    Slot &slot = slots[id & (slots.size() - 1)];
+    if (slot.refs == 0 || slot.id != id) return;
+    if (--slot.refs == 0) {
+      slot.value = T();  // release what the record holds
+      count--;
+    }
+  }
+
+  size_t size() const { return count; }
+  size_t capacity() const { return slots.size(); }
+  size_t max_capacity() const { return limit; }
+  //! Times the ring doubled since construction.
+  uint64_t growths() const { return grown; }
+
+ private:
+  struct Slot {
+    uint64_t id{0};
+    uint32_t refs{0};
+    T value{};
+  };
+
+  static size_t round_up(size_t c) {
+    size_t r = 2;
+    while (r < c) r <<= 1;
+    return r;
+  }
+
+  // double the ring: two live ids in one slot of the new ring would
+  // already have shared a slot of the old one, so every record has a slot
+  void grow() {
+    std::vector<Slot> old(slots.size() * 2);
+    old.swap(slots);
+    for (Slot &slot : old) {
+      if (slot.refs != 0) {
+        slots[slot.id & (slots.size() - 1)] = std::move(slot);
+      }
+    }
+    grown++;
+  }
+
+  std::vector<Slot> slots;
+  size_t limit;
+  size_t count{0};
+  uint64_t grown{0};
+};
+
+} // namespace ns3
+
+#endif // !P4_PACKET_CONTEXT_H
@@ -0,0 +1,133 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_QUEUE_POLICY_H
+#define P4_QUEUE_POLICY_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace ns3 {
+
+/**
+ * @brief Locking policy for the queues of the P4 switch when everything runs
+ * on the single ns-3 scheduler thread (the master branch).
+ *
+ * The mutex and the condition variable are empty types, so the queues
+ * compile down to the plain containers. Nothing can ever wait for another
+ * thread, so a blocking push on a full queue drops the element instead of
+ * waiting forever (see #can_block).
+ */
+struct NullLockingPolicy {
+  struct Mutex {
+    void lock() { }
+    void unlock() { }
+    bool try_lock() { return true; }
+  };
+
+  struct CondVar {
+    void notify_one() { }
+    void notify_all() { }
+    template <typename Lock>
+    void wait(Lock &) { }  // NOLINT(runtime/references)
+    template <typename Lock, typename Predicate>
+    void wait(Lock &, Predicate) { }  // NOLINT(runtime/references)
+  };
+
+  using Lock = std::unique_lock<Mutex>;
+
+  static constexpr bool can_block = false;
+};
+
+/**
+ * @brief Locking policy with the std::mutex and std::condition_variable used
+ * by the bmv2 queues, for a multi-threaded backend (as in the devbmv2 branch).
+ */
+struct MutexLockingPolicy {
+  using Mutex = std::mutex;
+  using CondVar = std::condition_variable;
+  using Lock = std::unique_lock<Mutex>;
+
+  static constexpr bool can_block = true;
+};
+
+/**
+ * @brief An unbounded single-threaded FIFO over a power-of-two ring buffer.
+ *
+ * The storage is contiguous and doubles when the ring is full, so push_back()
+ * and pop_front() are amortized O(1) without the chunk allocations of a
+ * std::deque. The callers (the egress queues) bound the occupancy themselves.
+ *
+ * @tparam T the element type, must be default constructible and movable
+ */
+template <typename T>
+class FifoRing {
+ public:
+  explicit FifoRing(size_t capacity = 8)
+      : mask(round_up(capacity) - 1),
+        cells(new T[mask + 1]) { }
+
+  FifoRing(FifoRing &&) = default;
+  FifoRing &operator =(FifoRing &&) = default;
+
+  void push_back(T &&item) {
+    if (tail - head > mask) grow();
+    cells[tail++ & mask] = std::move(item);
+  }
+
+  T &front() { return cells[head & mask]; }
+  const T &front() const { return cells[head & mask]; }
+
+  void pop_front() {
+    cells[head++ & mask] = T();  // release what the element holds
+  }
+
+  size_t size() const { return tail - head; }
+  bool empty() const { return tail == head; }
+
+ private:
+  static size_t round_up(size_t c) {
+    size_t r = 2;
+    while (r < c) r <<= 1;
+    return r;
+  }
+
+  void grow() {
+    size_t n = mask + 1;
+    std::unique_ptr<T[]> bigger(new T[2 * n]);
+    for (size_t i = 0; i < n; i++)
+      bigger[i] = std::move(cells[(head + i) & mask]);
+    cells = std::move(bigger);
+    head = 0;
+    tail = n;
+    mask = 2 * n - 1;
+  }
+
+  size_t mask;
+  std::unique_ptr<T[]> cells;
+  size_t head{0};
+  size_t tail{0};
+};
+
+} // namespace ns3
+
+#endif // !P4_QUEUE_POLICY_H
@@ -0,0 +1,955 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_QUEUEING_LOGIC_H
+#define P4_QUEUEING_LOGIC_H
+
+#include "ns3/nstime.h"
+#include "ns3/simulator.h"
+#include "ns3/p4-queue-policy.h"
+#include "ns3/p4-timing-wheel.h"
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * @brief How the egress port chooses among its priority queues, see
+ * NSQueueingLogicPriRL::set_scheduler().
+ */
+enum EgressScheduler {
+  SCHED_STRICT_PRIORITY,  //!< lowest priority index first (bmv2 default)
+  SCHED_DRR,              //!< deficit round robin, quantum x weight bytes
+  SCHED_WFQ,              //!< self-clocked weighted fair queueing
+  SCHED_PIFO,             //!< push-in first-out on a rank given at enqueue
+};
+
+/**
+ * @brief A simple priority queueing logic for ns-3 p4simulator.
+ * 
+ * [from bmv2 author]
+ * This class is slightly more advanced than QueueingLogicRL. The difference
+ * between the 2 is that this one offers the ability to set several priority
+ * queues for each logical queue. Priority queues are numbered from `0` to
+ * `nb_priorities` (see NSQueueingLogicPriRL::NSQueueingLogicPriRL()). Priority `0`
+ * is the highest priority queue. Each priority queue can have its own rate and
+ * its own capacity. Queues will be served in order of priority, until their
+ * respective maximum rate is reached. If no maximum rate is set, queues with a
+ * high priority can starve lower-priority queues. For example, if the queue
+ * with priority `0` always contains at least one element, the other queues
+ * will never be served.
+ * As for QueueingLogicRL, the write behavior (push_front()) is not blocking:
+ * once a logical queue is full, subsequent incoming elements will be dropped
+ * until the queue starts draining again.
+ * Look at the documentation for QueueingLogic for more information about the
+ * template parameters (they are the same).
+ * Within one priority queue the departure times only grow (see
+ * get_next_tp()), so each priority queue is a plain FIFO ring, and the
+ * queues of one worker with a given priority are ordered by the departure
+ * time of their head packet in a TimingWheel. Both push_front() and
+ * pop_back() are O(1) (amortized) in the number of queued packets. The
+ * wheels only serve the worker interface (pop_back(), get_next_departure()),
+ * so they are built on the first call to one of them and kept up to date
+ * from then on; a model which only uses pop_back_queue() never pays for them.
+ *
+ * The per-queue interface (pop_back_queue()) used by the egress ports goes
+ * through a scheduler chosen for every logical queue: strict priority, DRR
+ * or WFQ among the priority queues whose head packet may leave (the rate
+ * limits still apply), or a PIFO where all the packets of the logical queue
+ * are kept in a binary heap ordered by (rank, arrival) and the packet with
+ * the lowest rank leaves when its shaping time is reached. pop_back() of a
+ * worker always uses strict priority and does not see PIFO queues.
+ * The locking policy decides whether the queue takes a real mutex and signals
+ * condition variables (MutexLockingPolicy) or compiles down to the plain
+ * containers for the single-threaded ns-3 scheduler (NullLockingPolicy).
+ * 
+ * @tparam T 
+ * @tparam FMap 
+ * @tparam LockingPolicy NullLockingPolicy or MutexLockingPolicy
+ */
+template <typename T, typename FMap,
+          typename LockingPolicy = NullLockingPolicy>
+class NSQueueingLogicPriRL {
+  using MutexType = typename LockingPolicy::Mutex;
+  using LockType = typename LockingPolicy::Lock;
+
+ public:
+  
+  /**
+   * @brief Construct a new NSQueueingLogicPriRL object\
+   * 
+   * See QueueingLogic::QueueingLogicRL() for an introduction. The difference
+   * here is that each logical queue can receive several priority queues (as
+   * determined by \p nb_priorities, which is set to `2` by default). Each of
+   * these priority queues will initially be able to hold \p capacity
+   * elements. The capacity of each priority queue can be changed later by
+   * using set_capacity(size_t queue_id, size_t priority, size_t c).
+   * 
+   * @param nb_workers 
+   * @param capacity 
+   * @param map_to_worker 
+   * @param nb_priorities 
+   */
+  NSQueueingLogicPriRL(size_t nb_workers, size_t capacity,
+                     FMap map_to_worker, size_t nb_priorities = 2)
+      : nb_workers(nb_workers),
+        capacity(capacity),
+        workers_info(nb_workers),
+        map_to_worker(std::move(map_to_worker)),
+        nb_priorities(nb_priorities) {
+    for (auto &w_info : workers_info) w_info.wheels.resize(nb_priorities);
+  }
+
+  /**
+   * @brief Place the packet in the front of corresponding priority queue.
+   * If priority queue \p priority of logical queue \p queue_id is full, the
+   * function will return `0` immediately. Otherwise, \p item will be copied to
+   * the queue and the function will return `1`. If \p queue_id or \p priority
+   * are incorrect, an exception of type std::out_of_range will be thrown (same
+   * if the FMap object provided to the constructor does not behave correctly).
+   * 
+   * @param queue_id each egress port will have a queue_id
+   * @param priority the priroity of the packet in one queue
+   * @param item the packet or things to be placed in the queue
+   * @return int 
+   */
+  int push_front(size_t queue_id, size_t priority, const T &item) {
+    size_t worker_id = map_to_worker(queue_id);
+    LockType lock(mutex);
+    auto &q_info = get_queue(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    auto &q_info_pri = q_info.at(priority);
+    if (q_info_pri.size >= q_info_pri.capacity) return 0;
+    q_info_pri.last_sent = get_next_tp(&q_info_pri, 0);
+    enqueue(&w_info, &q_info,
+            QE(item, queue_id, priority, q_info_pri.last_sent,
+               w_info.wrapping_counter++, 0, 0));
+    return 1;
+  }
+
+  /**
+   * @brief  Place the packet in the queue. The state is priority queue not 
+   * enabled.
+   * 
+   * @param queue_id each egress port will have a queue_id
+   * @param item the packet or things to be placed in the queue
+   * @return int 
+   */
+  int push_front(size_t queue_id, const T &item) {
+    return push_front(queue_id, 0, item);
+  }
+
+  //! Same as push_front(size_t queue_id, size_t priority, const T &item), but
+  //! \p item is moved instead of copied.
+  int push_front(size_t queue_id, size_t priority, T &&item) {
+    return push_front(queue_id, priority, 0, std::move(item));
+  }
+
+  /**
+   * @brief Same as push_front(size_t queue_id, size_t priority, T &&item),
+   * with the length of the packet. The length is what a byte rate (see
+   * set_rate_bps()) charges to the token bucket of the priority queue; the
+   * other push_front() calls count as zero bytes.
+   *
+   * @param queue_id each egress port will have a queue_id
+   * @param priority the priroity of the packet in one queue
+   * @param bytes the length of the packet
+   * @param item the packet or things to be placed in the queue
+   * @return int
+   */
+  int push_front(size_t queue_id, size_t priority, size_t bytes, T &&item) {
+    return push_front(queue_id, priority, bytes, 0, std::move(item));
+  }
+
+  /**
+   * @brief Same as push_front(size_t queue_id, size_t priority, size_t bytes,
+   * T &&item), with the \p rank used when the logical queue is scheduled as
+   * a PIFO (lowest rank first). Other schedulers ignore it.
+   */
+  int push_front(size_t queue_id, size_t priority, size_t bytes,
+                 uint64_t rank, T &&item) {
+    size_t worker_id = map_to_worker(queue_id);
+    LockType lock(mutex);
+    auto &q_info = get_queue(queue_id);
+    auto &w_info = workers_info.at(worker_id);
+    auto &q_info_pri = q_info.at(priority);
+    if (q_info_pri.size >= q_info_pri.capacity) return 0;
+    q_info_pri.last_sent = get_next_tp(&q_info_pri, bytes);
+    enqueue(&w_info, &q_info,
+            QE(std::move(item), queue_id, priority, q_info_pri.last_sent,
+               w_info.wrapping_counter++, bytes, rank));
+    return 1;
+  }
+
+  int push_front(size_t queue_id, T &&item) {
+    return push_front(queue_id, 0, std::move(item));
+  }
+
+  
+  /**
+   * @brief The exit end of the priority queue is prioritized. (itself bmv2 code 
+   * through the lock mechanism, but ns-3 does not have a built-in locking 
+   * mechanism ns3 in the replacement for the polling mechanism, so there will
+   * be some loss in performance)
+   * 
+   * [from bmv2 author]
+   * Retrieves an element for the worker thread indentified by \p worker_id and
+   * moves it to \p pItem. The id of the logical queue which contained this
+   * element is copied to \p queue_id and the priority value of the served
+   * queue is copied to \p priority.
+   * Elements are retrieved according to the priority queue they are in
+   * (highest priorities, i.e. lowest priority values, are served first). Once
+   * a given priority queue reaches its maximum rate, the next queue is served.
+   * If no elements are available (either the queues are empty or they have
+   * exceeded their rate already), the function will block.
+   * 
+   * @ todo remove the lock mechanism, also the loops in the function
+   * 
+   * @param worker_id 
+   * @param queue_id 
+   * @param priority 
+   * @param pItem 
+   */
+  void pop_back(size_t worker_id, size_t *queue_id, size_t *priority,
+                T *pItem) {
+    LockType lock(mutex);
+    auto &w_info = workers_info.at(worker_id);
+    // Nothing to serve (empty, or every head packet is waiting for its rate
+    // slot): leave pItem untouched, the caller checks for a null packet.
+    if (w_info.size == 0) return;
+    enable_worker_wheels();
+    Time now = Simulator::Now();
+    for (size_t pri = 0; pri < nb_priorities; pri++) {
+      auto &wheel = w_info.wheels[pri];
+      TimingWheel::handle_t handle;
+      if (!wheel.peek(&handle)) continue;
+      QueueInfo &q_info = *queues_by_handle[handle];
+      if (q_info[pri].ring.front().send > now) continue;
+      *queue_id = q_info[pri].ring.front().queue_id;
+      *priority = pri;
+      *pItem = std::move(pop_ring(&w_info, &q_info, pri).e);
+      return;
+    }
+  }
+
+  /**
+   * @brief 
+   * Same as
+   * pop_back(size_t worker_id, size_t *queue_id, size_t *priority, T *pItem),
+   * but the priority of the popped element is discarded.
+   * 
+   * @param worker_id from bmv2 thread id, in ns-3 we only one, so ignore it
+   * @param queue_id the queue_id in each egress port
+   * @param pItem the packet or things to be pop out from queue
+   */
+  void pop_back(size_t worker_id, size_t *queue_id, T *pItem) {
+    size_t priority;
+    return pop_back(worker_id, queue_id, &priority, pItem);
+  }
+
+  /**
+   * @brief Get the earliest departure time of the packets waiting for the
+   * worker \p worker_id, which is the time when pop_back() will be able to
+   * retrieve the next element. This is used by the event driven scheduling
+   * to arm the egress event exactly when it is needed.
+   *
+   * @param worker_id from bmv2 thread id, in ns-3 we only one
+   * @param next the earliest departure time, untouched if the queues are empty
+   * @return true if there is at least one packet waiting
+   */
+  bool get_next_departure(size_t worker_id, Time *next) const {
+    LockType lock(mutex);
+    auto &w_info = workers_info.at(worker_id);
+    if (w_info.size == 0) return false;
+    enable_worker_wheels();
+    bool found = false;
+    for (size_t pri = 0; pri < nb_priorities; pri++) {
+      TimingWheel::handle_t handle;
+      if (!w_info.wheels[pri].peek(&handle)) continue;
+      const Time &send = queues_by_handle[handle]->at(pri).ring.front().send;
+      if (!found || send < *next) *next = send;
+      found = true;
+    }
+    return found;
+  }
+
+  /**
+   * @brief Same as pop_back(size_t worker_id, size_t *queue_id,
+   * size_t *priority, T *pItem), but only the priority queues of the logical
+   * queue \p queue_id are served. This lets every egress port drain on its
+   * own clock; the cost only depends on the number of priorities.
+   *
+   * @param queue_id the id of logical queue in each egress port
+   * @param priority the priority of the served queue
+   * @param pItem the packet, untouched if no packet may leave now
+   * @param arrival if not null, when the packet was queued
+   */
+  void pop_back_queue(size_t queue_id, size_t *priority, T *pItem,
+                      Time *arrival = nullptr) {
+    LockType lock(mutex);
+    auto it = queues_info.find(queue_id);
+    if (it == queues_info.end() || it->second.size == 0) return;
+    QueueInfo &q_info = it->second;
+    auto &w_info = workers_info.at(map_to_worker(queue_id));
+    Time now = Simulator::Now();
+    if (q_info.scheduler == SCHED_PIFO) {
+      auto &pifo = q_info.pifo;
+      // shaping at dequeue: the lowest rank waits for its departure time
+      if (pifo.front().send > now) return;
+      std::pop_heap(pifo.begin(), pifo.end(), RankComp());
+      *priority = pifo.back().priority;
+      if (arrival) *arrival = pifo.back().arrival;
+      *pItem = std::move(pifo.back().e);
+      pifo.pop_back();
+      dequeued(&w_info, &q_info, *priority);
+      return;
+    }
+    size_t pri = schedule(&q_info, now);
+    if (pri == nb_priorities) return;
+    *priority = pri;
+    QE qe = pop_ring(&w_info, &q_info, pri);
+    if (arrival) *arrival = qe.arrival;
+    *pItem = std::move(qe.e);
+  }
+
+  /**
+   * @brief Get the earliest departure time of the packets waiting in the
+   * logical queue \p queue_id (all priorities).
+   *
+   * @param queue_id the id of logical queue in each egress port
+   * @param next the earliest departure time, untouched if the queue is empty
+   * @return true if there is at least one packet waiting
+   */
+  bool get_queue_next_departure(size_t queue_id, Time *next) const {
+    LockType lock(mutex);
+    auto it = queues_info.find(queue_id);
+    if (it == queues_info.end() || it->second.size == 0) return false;
+    if (it->second.scheduler == SCHED_PIFO) {
+      *next = it->second.pifo.front().send;
+      return true;
+    }
+    bool found = false;
+    for (auto &q_info_pri : it->second) {
+      if (q_info_pri.ring.empty()) continue;
+      const Time &send = q_info_pri.ring.front().send;
+      if (!found || send < *next) *next = send;
+      found = true;
+    }
+    return found;
+  }
+
+  /**
+   * @brief  QueueingLogic::size
+   * @copydoc QueueingLogic::size
+   * The occupancies of all the priority queues for this logical queue are 
+   * added.
+   * @param queue_id the queue_id of logical queue in each egress port
+   * @return size_t 
+   */
+  size_t size(size_t queue_id) const {
+    LockType lock(mutex);
+    auto it = queues_info.find(queue_id);
+    if (it == queues_info.end()) return 0;
+    auto &q_info = it->second;
+    return q_info.size;
+  }
+
+  /**
+   * @brief Get the occupancy of priority queue \p priority for logical 
+   * queue with id \p queue_id.
+   * 
+   * @param queue_id the id of logical queue in each egress port
+   * @param priority the prirority of the packet in one logical queue 
+   * with \p queue_id
+   * @return size_t 
+   */
+  size_t size(size_t queue_id, size_t priority) const {
+    LockType lock(mutex);
+    auto it = queues_info.find(queue_id);
+    if (it == queues_info.end()) return 0;
+    auto &q_info = it->second;
+    auto &q_info_pri = q_info.at(priority);
+    return q_info_pri.size;
+  }
+
+  /**
+   * @brief Set the capacity of all the priority queues for logical 
+   * queue \p queue_id to \p c elements.
+   * 
+   * @param queue_id the id of logical queue in each egress port
+   * @param c number of packets in queue
+   */
+  void set_capacity(size_t queue_id, size_t c) {
+    LockType lock(mutex);
+    for_each_q(queue_id, SetCapacityFn(c));
+  }
+
+  /**
+   * @brief Set the capacity of priority queue with \p priority for 
+   * logical queue \p queue_id to \p c elements.
+   * 
+   * @param queue_id the id of logical queue in each egress port
+   * @param priority the \p priority number of one logical queue
+   * @param c number of packets in one priority queue
+   */
+  void set_capacity(size_t queue_id, size_t priority, size_t c) {
+    LockType lock(mutex);
+    for_one_q(queue_id, priority, SetCapacityFn(c));
+  }
+
+  /**
+   * @brief Set the capacity of all the priority queues of all 
+   * logical queues to \p c elements.
+   * 
+   * @param c number of packets in one priority queue
+   */
+  void set_capacity_for_all(size_t c) {
+    LockType lock(mutex);
+    for (auto &p : queues_info) for_each_q(p.first, SetCapacityFn(c));
+    capacity = c;
+  }
+
+  //! Set the maximum rate of all the priority queues for logical queue \p
+  //! queue_id to \p pps. \p pps is expressed in "number of elements per
+  //! second". Until this function is called, there will be no rate limit for
+  //! the queue. The same behavior (no rate limit) can be achieved by calling
+  //! this method with a rate of 0.
+
+  /**
+   * @brief Set the rate of processing packets
+   * Set the maximum rate of all the priority queues for logical queue \p
+   * queue_id to \p pps. \p pps is expressed in "number of elements per
+   * second". Until this function is called, there will be no rate limit for
+   * the queue. The same behavior (no rate limit) can be achieved by calling
+   * this method with a rate of 0.
+   * 
+   * @param queue_id the id of logical queue in each egress port
+   * @param pps packets per second
+   */
+  void set_rate(size_t queue_id, uint64_t pps) {
+    LockType lock(mutex);
+    for_each_q(queue_id, SetRateFn(pps));
+  }
+
+  /**
+   * @brief Set the rate object
+   * Same as set_rate(size_t queue_id, uint64_t pps) but only applies 
+   * to the given priority queue.
+   * @param queue_id the id of logical queue in each egress port
+   * @param priority the prirority of the packet in one logical queue 
+   * @param pps packets per second
+   */
+  void set_rate(size_t queue_id, size_t priority, uint64_t pps) {
+    LockType lock(mutex);
+    for_one_q(queue_id, priority, SetRateFn(pps));
+  }
+
+  /**
+   * @brief Set the rate of all the priority queues of all logical 
+   * queues to \p pps.
+   * 
+   * @param pps 
+   */
+  void set_rate_for_all(uint64_t pps) {
+    LockType lock(mutex);
+    for (auto &p : queues_info) for_each_q(p.first, SetRateFn(pps));
+    queue_rate_pps = pps;
+    queue_rate_bps = 0;
+  }
+
+  /**
+   * @brief Shape all the priority queues of logical queue \p queue_id with a
+   * token bucket of \p bps bits per second and \p burst_bytes bytes. Every
+   * packet takes its length (see push_front(size_t queue_id, size_t priority,
+   * size_t bytes, T &&item)) from the bucket, so the departures are exact
+   * for any mix of packet sizes. A packet longer than the burst waits for
+   * its whole transmission time. This replaces the packet rate of the queues,
+   * until set_rate() is called again; a rate of 0 goes back to the (default)
+   * packet rate.
+   *
+   * @param queue_id the id of logical queue in each egress port
+   * @param bps bits per second
+   * @param burst_bytes the depth of the token bucket
+   */
+  void set_rate_bps(size_t queue_id, uint64_t bps, size_t burst_bytes) {
+    LockType lock(mutex);
+    for_each_q(queue_id, SetRateBpsFn(bps, burst_bytes));
+  }
+
+  //! Same as set_rate_bps(size_t queue_id, uint64_t bps, size_t burst_bytes)
+  //! but only applies to the given priority queue.
+  void set_rate_bps(size_t queue_id, size_t priority, uint64_t bps,
+                    size_t burst_bytes) {
+    LockType lock(mutex);
+    for_one_q(queue_id, priority, SetRateBpsFn(bps, burst_bytes));
+  }
+
+  //! Same as set_rate_bps(size_t queue_id, uint64_t bps, size_t burst_bytes)
+  //! for all the priority queues of all logical queues.
+  void set_rate_bps_for_all(uint64_t bps, size_t burst_bytes) {
+    LockType lock(mutex);
+    for (auto &p : queues_info)
+      for_each_q(p.first, SetRateBpsFn(bps, burst_bytes));
+    queue_rate_bps = bps;
+    queue_burst_bytes = burst_bytes;
+  }
+
+  /**
+   * @brief Choose how the logical queue \p queue_id picks the next packet
+   * among its priority queues (see EgressScheduler). The packets already
+   * queued keep their order: if the queue is not empty, the new scheduler
+   * takes over once it has drained.
+   *
+   * @param queue_id the id of logical queue in each egress port
+   * @param scheduler the scheduling discipline
+   */
+  void set_scheduler(size_t queue_id, EgressScheduler scheduler) {
+    LockType lock(mutex);
+    get_queue(queue_id).set_scheduler(scheduler);
+  }
+
+  //! Same as set_scheduler(size_t queue_id, EgressScheduler scheduler) for
+  //! all logical queues.
+  void set_scheduler_for_all(EgressScheduler scheduler) {
+    LockType lock(mutex);
+    for (auto &p : queues_info) p.second.set_scheduler(scheduler);
+    default_scheduler = scheduler;
+  }
+
+  /**
+   * @brief Set the weight of priority queue \p priority of logical queue
+   * \p queue_id (1 by default). DRR gives it a quantum of weight x quantum
+   * bytes per round, WFQ a share of the bandwidth proportional to it.
+   *
+   * @param queue_id the id of logical queue in each egress port
+   * @param priority the priority queue
+   * @param weight at least 1
+   */
+  void set_weight(size_t queue_id, size_t priority, uint32_t weight) {
+    LockType lock(mutex);
+    get_queue(queue_id).at(priority).weight = std::max<uint32_t>(weight, 1);
+  }
+
+  //! Set the DRR quantum of all the logical queues, in bytes (at least 1).
+  void set_quantum_for_all(size_t quantum_bytes) {
+    LockType lock(mutex);
+    default_quantum = std::max<size_t>(quantum_bytes, 1);
+    for (auto &p : queues_info) p.second.drr_quantum = default_quantum;
+  }
+
+  //! Deleted copy constructor
+  NSQueueingLogicPriRL(const NSQueueingLogicPriRL &) = delete;
+  //! Deleted copy assignment operator
+  NSQueueingLogicPriRL &operator =(const NSQueueingLogicPriRL &) = delete;
+
+  //! Deleted move constructor
+  NSQueueingLogicPriRL(NSQueueingLogicPriRL &&) = delete;
+  //! Deleted move assignment operator
+  NSQueueingLogicPriRL &&operator =(NSQueueingLogicPriRL &&) = delete;
+
+ private:
+  
+  /**
+   * @brief calculate the intermediate time interval for processing
+   * one packet. 1 pps = 1 packet per second,  default is 1ms for 
+   * one packet. pps should not set to 0.
+   * 
+   * @param pps 
+   * @return constexpr Time 
+   */
+  static constexpr Time rate_to_time(uint64_t pps) {
+    
+    return (pps == 0) ?
+        Seconds (0.001) : Seconds (static_cast<double>(1. / static_cast<double>(pps)));
+  }
+
+  /**
+   * @brief The control label of the packet, the queue it is in, 
+   * the timestamp, etc.
+   */
+  struct QE {
+    QE() = default;
+    QE(T e, size_t queue_id, size_t priority, const Time &send, size_t id,
+       size_t bytes, uint64_t rank)
+        : e(std::move(e)), queue_id(queue_id), priority(priority), send(send),
+          arrival(Simulator::Now()), id(id), bytes(bytes), rank(rank) { }
+
+    T e{};
+    size_t queue_id{0};
+    size_t priority{0};
+    Time send{};
+    Time arrival{};  // when the packet was queued
+    size_t id{0};  // arrival order, breaks the ties between equal send times
+    size_t bytes{0};
+    uint64_t rank{0};  // PIFO rank or WFQ finish tag
+  };
+
+  //! Heap order of the PIFO, lowest (rank, id) on top.
+  struct RankComp {
+    bool operator()(const QE &lhs, const QE &rhs) const {
+      return (lhs.rank == rhs.rank) ? lhs.id > rhs.id : lhs.rank > rhs.rank;
+    }
+  };
+
+  /**
+   * @brief information for each prioriry queue.
+   * 
+   */
+  struct QueueInfoPri {
+    QueueInfoPri(size_t capacity, uint64_t queue_rate_pps,
+                 uint64_t queue_rate_bps, size_t burst_bytes)
+        : capacity(capacity),
+          queue_rate_pps(queue_rate_pps),
+          pkt_delay_time(rate_to_time(queue_rate_pps)),
+          last_sent(Simulator::Now()) {
+      set_token_bucket(queue_rate_bps, burst_bytes);
+    }
+
+    //! A full bucket of \p burst_bytes filled at \p bps, 0 to disable.
+    void set_token_bucket(uint64_t bps, size_t burst_bytes) {
+      rate_bps = bps;
+      bucket_depth = burst_bytes * 8 * kTokensPerBit;
+      tokens = bucket_depth;
+      bucket_time = Simulator::Now();
+    }
+
+    size_t capacity;
+    uint64_t queue_rate_pps;
+    Time pkt_delay_time;
+    Time last_sent;
+    // token bucket, a token is 1e-9 bit so that the bucket gains exactly
+    // rate_bps tokens per nanosecond (no rounding drift)
+    uint64_t rate_bps{0};
+    uint64_t bucket_depth{0};
+    uint64_t tokens{0};
+    Time bucket_time{};  // when tokens was last updated
+    FifoRing<QE> ring{};  // send times are increasing, so FIFO order
+    size_t size{0};  // in the ring, or in the PIFO of the logical queue
+    uint32_t weight{1};  // DRR / WFQ
+    uint64_t deficit{0};  // DRR, bytes
+    uint64_t last_finish{0};  // WFQ finish tag of the last packet
+  };
+
+  /**
+   * @brief information for each logical queue (containing multiple 
+   * priority queues).
+   */
+  struct QueueInfo : public std::vector<QueueInfoPri> {
+    // takes the current defaults of \p logic
+    QueueInfo(const NSQueueingLogicPriRL &logic, TimingWheel::handle_t handle)
+        : handle(handle),
+          scheduler(logic.default_scheduler),
+          next_scheduler(logic.default_scheduler),
+          drr_quantum(logic.default_quantum) {
+      // the rings are move-only, so no vector(n, value) here
+      this->reserve(logic.nb_priorities);
+      for (size_t i = 0; i < logic.nb_priorities; i++) {
+        this->emplace_back(logic.capacity, logic.queue_rate_pps,
+                           logic.queue_rate_bps, logic.queue_burst_bytes);
+      }
+    }
+
+    void set_scheduler(EgressScheduler s) {
+      next_scheduler = s;
+      if (size == 0) scheduler = s;
+    }
+
+    size_t size{0};
+    TimingWheel::handle_t handle;  // index in queues_by_handle
+    EgressScheduler scheduler;
+    EgressScheduler next_scheduler;  // applied when the queue is empty
+    size_t drr_quantum;
+    size_t drr_current{0};  // priority queue visited by DRR
+    bool drr_visited{false};  // its quantum was granted for this visit
+    uint64_t virtual_time{0};  // WFQ, finish tag of the last packet served
+    std::vector<QE> pifo{};  // binary heap, RankComp
+  };
+  
+  /**
+   * @brief threads information from bmv2 src.
+   * 
+   */
+  struct WorkerInfo {
+    mutable typename LockingPolicy::CondVar q_not_empty{};
+    size_t size{0};
+    // one wheel per priority, holding the non empty queues of this worker
+    // keyed by the send time of their head packet (peek() may cascade the
+    // wheel, hence mutable)
+    mutable std::vector<TimingWheel> wheels{};
+    size_t wrapping_counter{0};
+  };
+
+  QueueInfo &get_queue(size_t queue_id) {
+    auto it = queues_info.find(queue_id);
+    if (it != queues_info.end()) return it->second;
+    auto p = queues_info.emplace(
+        queue_id, QueueInfo(*this, queues_by_handle.size()));
+    // references to the elements of an unordered_map stay valid on rehash
+    queues_by_handle.push_back(&p.first->second);
+    return p.first->second;
+  }
+
+  void enqueue(WorkerInfo *w_info, QueueInfo *q_info, QE &&qe) {
+    auto &q_info_pri = q_info->at(qe.priority);
+    q_info_pri.size++;
+    q_info->size++;
+    w_info->size++;
+    if (q_info->scheduler == SCHED_PIFO) {
+      q_info->pifo.push_back(std::move(qe));
+      std::push_heap(q_info->pifo.begin(), q_info->pifo.end(), RankComp());
+    } else {
+      if (q_info->scheduler == SCHED_WFQ) {
+        // the finish tag of the packet, at least one byte so that the
+        // virtual time always moves
+        uint64_t start = std::max(q_info->virtual_time, q_info_pri.last_finish);
+        q_info_pri.last_finish = start + std::max<uint64_t>(qe.bytes, 1) *
+            kWfqScale / q_info_pri.weight;
+        qe.rank = q_info_pri.last_finish;
+      }
+      if (worker_wheels && q_info_pri.ring.empty()) {
+        w_info->wheels[qe.priority].insert(
+            q_info->handle, qe.send.GetTimeStep(), qe.id);
+      }
+      q_info_pri.ring.push_back(std::move(qe));
+    }
+    w_info->q_not_empty.notify_one();
+  }
+
+  //! Take the head packet of priority queue \p pri out of its ring.
+  QE pop_ring(WorkerInfo *w_info, QueueInfo *q_info, size_t pri) {
+    auto &ring = q_info->at(pri).ring;
+    QE qe = std::move(ring.front());
+    ring.pop_front();
+    if (worker_wheels) {
+      auto &wheel = w_info->wheels[pri];
+      wheel.erase(q_info->handle);
+      if (!ring.empty()) {
+        wheel.insert(q_info->handle, ring.front().send.GetTimeStep(),
+                     ring.front().id);
+      }
+    }
+    dequeued(w_info, q_info, pri);
+    return qe;
+  }
+
+  //! Fill the wheels of the workers with the queues waiting so far, once.
+  void enable_worker_wheels() const {
+    if (worker_wheels) return;
+    worker_wheels = true;
+    for (QueueInfo *q_info : queues_by_handle) {
+      for (size_t pri = 0; pri < nb_priorities; pri++) {
+        const auto &ring = q_info->at(pri).ring;
+        if (ring.empty()) continue;
+        const QE &head = ring.front();
+        workers_info.at(map_to_worker(head.queue_id)).wheels[pri].insert(
+            q_info->handle, head.send.GetTimeStep(), head.id);
+      }
+    }
+  }
+
+  void dequeued(WorkerInfo *w_info, QueueInfo *q_info, size_t pri) {
+    auto &q_info_pri = q_info->at(pri);
+    if (--q_info_pri.size == 0) q_info_pri.deficit = 0;
+    w_info->size--;
+    if (--q_info->size == 0) {
+      // idle: restart the WFQ virtual clock, switch scheduler if asked
+      q_info->virtual_time = 0;
+      for (auto &info : *q_info) info.last_finish = 0;
+      q_info->scheduler = q_info->next_scheduler;
+      q_info->drr_visited = false;
+    }
+  }
+
+  /**
+   * @brief Pick the priority queue of \p q_info to serve now, among the
+   * ones whose head packet may leave, and charge it to the scheduler state.
+   * @return the priority, nb_priorities if no packet may leave
+   */
+  size_t schedule(QueueInfo *q_info, const Time &now) {
+    auto eligible = [q_info, &now](size_t pri) {
+      auto &ring = (*q_info)[pri].ring;
+      return !ring.empty() && ring.front().send <= now;
+    };
+    size_t best = nb_priorities;
+    switch (q_info->scheduler) {
+      case SCHED_WFQ:
+        for (size_t pri = 0; pri < nb_priorities; pri++) {
+          if (!eligible(pri)) continue;
+          if (best == nb_priorities ||
+              RankComp()((*q_info)[best].ring.front(),
+                         (*q_info)[pri].ring.front()))
+            best = pri;
+        }
+        if (best != nb_priorities)
+          q_info->virtual_time = (*q_info)[best].ring.front().rank;
+        return best;
+      case SCHED_DRR:
+        for (size_t pri = 0; pri < nb_priorities && best == nb_priorities;
+             pri++) {
+          if (eligible(pri)) best = pri;
+        }
+        if (best == nb_priorities) return best;
+        // terminates: every round grants a quantum to the eligible queues
+        while (true) {
+          size_t pri = q_info->drr_current;
+          auto &q_info_pri = (*q_info)[pri];
+          if (eligible(pri)) {
+            if (!q_info->drr_visited) {
+              q_info_pri.deficit += q_info->drr_quantum * q_info_pri.weight;
+              q_info->drr_visited = true;
+            }
+            size_t bytes = std::max<size_t>(q_info_pri.ring.front().bytes, 1);
+            if (bytes <= q_info_pri.deficit) {
+              q_info_pri.deficit -= bytes;
+              return pri;
+            }
+          }
+          q_info->drr_current = (pri + 1) % nb_priorities;
+          q_info->drr_visited = false;
+        }
+      default:
+        for (size_t pri = 0; pri < nb_priorities; pri++) {
+          if (eligible(pri)) return pri;
+        }
+        return nb_priorities;
+    }
+  }
+
+  const QueueInfo &get_queue_or_throw(size_t queue_id) const {
+    return queues_info.at(queue_id);
+  }
+
+  QueueInfo &get_queue_or_throw(size_t queue_id) {
+    return queues_info.at(queue_id);
+  }
+
+  Time get_next_tp(QueueInfoPri *q_info_pri, size_t bytes) {
+    if (q_info_pri->rate_bps != 0) return take_tokens(q_info_pri, bytes);
+    // Calculate when the next step should be sent
+    return (Simulator::Now() > q_info_pri->last_sent + q_info_pri->pkt_delay_time) ? 
+            Simulator::Now() : q_info_pri->last_sent + q_info_pri->pkt_delay_time;
+  }
+
+  /**
+   * @brief Departure time of a packet of \p bytes with the token bucket of
+   * the priority queue. The packets of one queue leave in order, so the
+   * bucket is refilled up to the departure of the previous packet (or now)
+   * and the packet waits for the missing tokens, if any.
+   */
+  static Time take_tokens(QueueInfoPri *q, size_t bytes) {
+    Time start = std::max(Simulator::Now(), q->last_sent);
+    uint64_t elapsed_ns = (start - q->bucket_time).GetNanoSeconds();
+    if (q->tokens < q->bucket_depth) {
+      uint64_t room = q->bucket_depth - q->tokens;
+      // compare first, elapsed_ns * rate_bps may overflow
+      q->tokens = (elapsed_ns > room / q->rate_bps)
+          ? q->bucket_depth : q->tokens + elapsed_ns * q->rate_bps;
+      q->tokens = std::min(q->tokens, q->bucket_depth);
+    }
+    q->bucket_time = start;
+    uint64_t needed = static_cast<uint64_t>(bytes) * 8 * kTokensPerBit;
+    if (q->tokens >= needed) {
+      q->tokens -= needed;
+      return start;
+    }
+    uint64_t wait_ns = (needed - q->tokens + q->rate_bps - 1) / q->rate_bps;
+    q->tokens = q->tokens + wait_ns * q->rate_bps - needed;
+    q->bucket_time = start + NanoSeconds(wait_ns);
+    return q->bucket_time;
+  }
+
+  template <typename Function>
+  Function for_each_q(size_t queue_id, Function fn) {
+    auto &q_info = get_queue(queue_id);
+    for (auto &q_info_pri : q_info) fn(q_info_pri);
+    return fn;
+  }
+
+  template <typename Function>
+  Function for_one_q(size_t queue_id, size_t priority, Function fn) {
+    auto &q_info = get_queue(queue_id);
+    auto &q_info_pri = q_info.at(priority);
+    fn(q_info_pri);
+    return fn;
+  }
+
+  struct SetCapacityFn {
+    explicit SetCapacityFn(size_t c)
+        : c(c) { }
+
+    void operator ()(QueueInfoPri &info) const {  // NOLINT(runtime/references)
+      info.capacity = c;
+    }
+
+    size_t c;
+  };
+
+  struct SetRateFn {
+    explicit SetRateFn(uint64_t pps)
+        : pps(pps) {
+      pkt_delay_time = rate_to_time(pps);
+    }
+
+    void operator ()(QueueInfoPri &info) const {  // NOLINT(runtime/references)
+      info.queue_rate_pps = pps;
+      info.pkt_delay_time = pkt_delay_time;
+      info.rate_bps = 0;
+    }
+
+    uint64_t pps;
+    Time pkt_delay_time;
+  };
+
+  struct SetRateBpsFn {
+    SetRateBpsFn(uint64_t bps, size_t burst_bytes)
+        : bps(bps), burst_bytes(burst_bytes) { }
+
+    void operator ()(QueueInfoPri &info) const {  // NOLINT(runtime/references)
+      info.set_token_bucket(bps, burst_bytes);
+    }
+
+    uint64_t bps;
+    size_t burst_bytes;
+  };
+
+  static constexpr uint64_t kTokensPerBit = 1000000000;  // ns per second
+  static constexpr uint64_t kWfqScale = 1 << 16;  // finish tag per byte
+
+  mutable MutexType mutex;
+  size_t nb_workers;
+  size_t capacity;  // default capacity
+  uint64_t queue_rate_pps{0};  // default rate
+  uint64_t queue_rate_bps{0};  // default byte rate, 0 to use queue_rate_pps
+  size_t queue_burst_bytes{0};  // default token bucket depth
+  EgressScheduler default_scheduler{SCHED_STRICT_PRIORITY};
+  size_t default_quantum{1500};  // DRR, bytes
+  std::unordered_map<size_t, QueueInfo> queues_info{};
+  std::vector<WorkerInfo> workers_info{};
+  std::vector<QueueInfo *> queues_by_handle{};
+  FMap map_to_worker;
+  size_t nb_priorities;
+  // the wheels are up to date, see enable_worker_wheels()
+  mutable bool worker_wheels{false};
+};
+
+} // namespace ns3
+
+#endif // !P4_QUEUEING_LOGIC_H
@@ -0,0 +1,154 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_STAGE_PROFILER_H
+#define P4_STAGE_PROFILER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace ns3 {
+
+// Stages of a P4 switch timed by P4StageProfiler
+enum P4ProfiledStage {
+  P4_STAGE_RECEIVE = 0,  //!< ns3::Packet to bm::Packet, context
+  P4_STAGE_PARSE,        //!< parser
+  P4_STAGE_INGRESS,      //!< ingress match-action pipeline
+  P4_STAGE_QUEUE,        //!< input buffer and egress queue operations, one
+                         //!< packet per egress pop
+  P4_STAGE_EGRESS,       //!< egress match-action pipeline
+  P4_STAGE_DEPARSE,      //!< deparser
+  P4_STAGE_TRANSMIT,     //!< bm::Packet to ns3::Packet, tags
+  P4_STAGE_COUNT
+};
+
+/**
+ * @brief CPU time spent by a P4 switch in each of its stages.
+ *
+ * A stage is timed with the time stamp counter (rdtsc, a few tens of
+ * cycles), or with std::chrono::steady_clock on other CPUs. The counter is
+ * converted to seconds with its rate over the life of the profiler,
+ * measured against steady_clock, so nothing is calibrated at startup.
+ */
+class P4StageProfiler {
+ public:
+  P4StageProfiler()
+      : startTicks(ticks()), startTime(std::chrono::steady_clock::now()) { }
+
+  static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  //! Charge the ticks since \p start to \p stage, for one packet unless
+  //! \p packet is false (another operation on a packet already counted).
+  void add(P4ProfiledStage stage, uint64_t start, bool packet = true) {
+    Stage &s = stages[stage];
+    s.ticks += ticks() - start;
+    s.calls += packet;
+  }
+
+  void merge(const P4StageProfiler &other) {
+    for (size_t i = 0; i < P4_STAGE_COUNT; i++) {
+      stages[i].ticks += other.stages[i].ticks;
+      stages[i].calls += other.stages[i].calls;
+    }
+  }
+
+  uint64_t calls(P4ProfiledStage stage) const { return stages[stage].calls; }
+
+  //! Write one line per stage: packets, CPU seconds, share of the wall
+  //! clock time since construction, ns per packet and packets per second
+  //! of CPU time in the stage.
+  void report(std::ostream &os, const std::string &title) const {
+    static const char *names[P4_STAGE_COUNT] = {
+        "receive", "parse", "ingress", "queue", "egress", "deparse", "transmit"};
+    double wall = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - startTime).count();
+    double rate = wall > 0 ? double(ticks() - startTicks) / wall : 0;
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << title << ": " << std::fixed << std::setprecision(3) << wall
+       << " s wall clock" << std::endl;
+    os << "  stage          packets     cpu s   wall %    ns/pkt      pkt/s" << std::endl;
+    for (size_t i = 0; i < P4_STAGE_COUNT; i++) {
+      const Stage &s = stages[i];
+      double seconds = rate > 0 ? s.ticks / rate : 0;
+      os << "  " << std::left << std::setw(9) << names[i] << std::right
+         << std::setw(13) << s.calls
+         << std::setw(10) << std::setprecision(3) << seconds
+         << std::setw(9) << std::setprecision(2) << (wall > 0 ? 100 * seconds / wall : 0)
+         << std::setw(10) << std::setprecision(1) << (s.calls ? 1e9 * seconds / s.calls : 0)
+         << std::setw(11) << std::setprecision(0) << (seconds > 0 ? s.calls / seconds : 0)
+         << std::endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+  }
+
+ private:
+  struct Stage {
+    uint64_t ticks{0};
+    uint64_t calls{0};
+  };
+
+  std::array<Stage, P4_STAGE_COUNT> stages{};
+  uint64_t startTicks;
+  std::chrono::steady_clock::time_point startTime;
+};
+
+/**
+ * @brief Charge the lifetime of the timer to a stage of \p profiler, no-op
+ * (one branch) when \p profiler is null.
+ */
+class P4StageTimer {
+ public:
+  P4StageTimer(P4StageProfiler *profiler, P4ProfiledStage stage,
+               bool packet = true)
+      : profiler(profiler), stage(stage), packet(packet),
+        start(profiler ? P4StageProfiler::ticks() : 0) { }
+
+  ~P4StageTimer() {
+    if (profiler) profiler->add(stage, start, packet);
+  }
+
+ private:
+  P4StageTimer(const P4StageTimer &);
+  P4StageTimer &operator=(const P4StageTimer &);
+
+  P4StageProfiler *profiler;
+  P4ProfiledStage stage;
+  bool packet;
+  uint64_t start;
+};
+
+} // namespace ns3
+
+#endif // !P4_STAGE_PROFILER_H
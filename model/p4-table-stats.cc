@@ -0,0 +1,297 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+
+#include "ns3/p4-table-stats.h"
+#include "ns3/helper.h"
+#include "ns3/p4-stage-profiler.h"
+#include <bm/bm_sim/event_logger.h>
+#include <bm/bm_sim/logger.h>
+#include <bm/bm_sim/transport.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+
+namespace ns3 {
+
+namespace {
+
+// messages of the bmv2 event logger, from src/bm_sim/event_logger.cpp of
+// p4lang/behavioral-model 1.15.0 (the same since the event logger has had
+// its table and action messages). A table hit also carries the entry
+// handle after the table id, not read here.
+enum EventType {
+  PIPELINE_START = 9,
+  TABLE_HIT = 12,
+  TABLE_MISS = 13,
+  ACTION_EXECUTE = 14
+};
+
+struct msg_hdr_t {
+  int type;
+  int switch_id;
+  int cxt_id;
+  uint64_t sig;
+  uint64_t id;
+  uint64_t copy_id;
+} __attribute__((packed));
+
+struct pipeline_msg_t : msg_hdr_t {
+  int pipeline_id;
+} __attribute__((packed));
+
+struct table_msg_t : msg_hdr_t {
+  int table_id;
+} __attribute__((packed));
+
+struct action_msg_t : msg_hdr_t {
+  int action_id;
+} __attribute__((packed));
+
+// transport of the event logger which counts the table events, only
+// P4TableStatistics::Current() gets them. Every event also goes on to
+// \p next, the transport of the event logger address, if any.
+class TableEventTransport : public bm::TransportIface {
+public:
+  explicit TableEventTransport(std::unique_ptr<bm::TransportIface> next)
+      : m_next(std::move(next)) {}
+
+private:
+  int open_() override { return m_next ? m_next->open() : 0; }
+
+  int send_(const std::string &msg) const override {
+    return send_(msg.data(), static_cast<int>(msg.size()));
+  }
+
+  int send_(const char *msg, int len) const override {
+    if (m_next) {
+      m_next->send(msg, len);
+    }
+    P4TableStatistics *stats = P4TableStatistics::Current();
+    if (stats != nullptr) {
+      stats->Receive(msg, len);
+    }
+    return 0;
+  }
+
+  int send_msgs_(const std::initializer_list<std::string> &msgs) const override {
+    for (const auto &msg : msgs) {
+      send_(msg);
+    }
+    return 0;
+  }
+
+  int send_msgs_(const std::initializer_list<bm::MsgBuf> &msgs) const override {
+    for (const auto &msg : msgs) {
+      send_(msg.buf, static_cast<int>(msg.len));
+    }
+    return 0;
+  }
+
+  std::unique_ptr<bm::TransportIface> m_next;
+};
+
+} // namespace
+
+P4TableStatistics *P4TableStatistics::s_current = nullptr;
+
+P4TableStatistics::P4TableStatistics(const Json::Value &config, bool timing,
+                                     const std::string &event_logger_addr)
+    : m_timing(timing),
+      m_startTicks(P4StageProfiler::ticks()),
+      m_startTime(std::chrono::steady_clock::now()) {
+  static bool installed = false;
+  if (!installed) {
+    std::unique_ptr<bm::TransportIface> next;
+#ifdef BMNANOMSG_ON
+    if (!event_logger_addr.empty()) {
+      next = bm::TransportIface::make_nanomsg(event_logger_addr);
+    }
+#endif
+    std::unique_ptr<bm::TransportIface> transport(new TableEventTransport(std::move(next)));
+    transport->open();
+    bm::EventLogger::init(std::move(transport));
+    installed = true;
+  }
+  for (const auto &table : P4TableNames(config)) {
+    GetTable(table.first).name = table.second;
+  }
+  for (const auto &action : P4ActionNames(config)) {
+    if (action.first >= static_cast<int>(m_actions.size())) {
+      m_actions.resize(action.first + 1);
+    }
+    m_actions[action.first].name = action.second;
+  }
+}
+
+const std::vector<P4TableStatistics::Table> &P4TableStatistics::GetTables() const {
+  return m_tables;
+}
+
+const std::vector<P4TableStatistics::Action> &P4TableStatistics::GetActions() const {
+  return m_actions;
+}
+
+bool P4TableStatistics::IsTiming() const { return m_timing; }
+
+void P4TableStatistics::Reset() {
+  for (auto &table : m_tables) {
+    table.lookups = table.hits = table.ticks = 0;
+  }
+  for (auto &action : m_actions) {
+    action.calls = 0;
+  }
+  m_pipelines = m_pipelineStarts = 0;
+}
+
+P4TableStatistics *P4TableStatistics::Current() { return s_current; }
+
+P4TableStatistics::Table &P4TableStatistics::GetTable(int table_id) {
+  if (table_id >= static_cast<int>(m_tables.size())) {
+    m_tables.resize(table_id + 1);
+  }
+  return m_tables[table_id];
+}
+
+void P4TableStatistics::BeginPipeline() {
+  m_lastTable = 0;
+  if (m_timing) {
+    m_lastTicks = P4StageProfiler::ticks();
+  }
+}
+
+void P4TableStatistics::EndPipeline() {
+  if (m_timing && m_lastTable != 0) {
+    m_tables[m_lastTable - 1].ticks += P4StageProfiler::ticks() - m_lastTicks;
+  }
+  m_pipelines++;
+  if (m_pipelineStarts != m_pipelines && !m_mismatch) {
+    m_mismatch = true;
+    bm::Logger::get()->warn("The bmv2 event messages do not match the layout of "
+                            "P4TableStatistics, the table statistics are unreliable");
+  }
+}
+
+void P4TableStatistics::Receive(const char *msg, int len) {
+  if (len < static_cast<int>(sizeof(msg_hdr_t))) {
+    return;
+  }
+  int type;
+  std::memcpy(&type, msg, sizeof(type));
+  if (type == PIPELINE_START && len == static_cast<int>(sizeof(pipeline_msg_t))) {
+    m_pipelineStarts++;
+  } else if ((type == TABLE_HIT || type == TABLE_MISS)
+             && len >= static_cast<int>(sizeof(table_msg_t))) {
+    table_msg_t table;
+    std::memcpy(&table, msg, sizeof(table));
+    TableLookup(table.table_id, type == TABLE_HIT);
+  } else if (type == ACTION_EXECUTE && len >= static_cast<int>(sizeof(action_msg_t))) {
+    action_msg_t action;
+    std::memcpy(&action, msg, sizeof(action));
+    ActionCall(action.action_id);
+  }
+}
+
+bool P4TableStatistics::IsMismatched() const { return m_mismatch; }
+
+void P4TableStatistics::TableLookup(int table_id, bool hit) {
+  if (table_id < 0) {
+    return;
+  }
+  Table &table = GetTable(table_id);
+  table.lookups++;
+  table.hits += hit;
+  if (m_timing) {
+    uint64_t now = P4StageProfiler::ticks();
+    table.ticks += now - m_lastTicks;
+    m_lastTicks = now;
+    m_lastTable = table_id + 1;
+  }
+}
+
+void P4TableStatistics::ActionCall(int action_id) {
+  if (action_id < 0) {
+    return;
+  }
+  if (action_id >= static_cast<int>(m_actions.size())) {
+    m_actions.resize(action_id + 1);
+  }
+  m_actions[action_id].calls++;
+}
+
+void P4TableStatistics::Report(std::ostream &os, const std::string &title) const {
+  std::ios::fmtflags flags = os.flags();
+  std::streamsize precision = os.precision();
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+  double rate = wall > 0 ? double(P4StageProfiler::ticks() - m_startTicks) / wall : 0;
+  uint64_t total_ticks = 0;
+  std::vector<const Table *> tables;
+  for (const auto &table : m_tables) {
+    total_ticks += table.ticks;
+    if (!table.name.empty() || table.lookups != 0) {
+      tables.push_back(&table);
+    }
+  }
+  std::stable_sort(tables.begin(), tables.end(), [](const Table *a, const Table *b) {
+    return a->ticks != b->ticks ? a->ticks > b->ticks : a->lookups > b->lookups;
+  });
+
+  os << title << std::endl << std::fixed;
+  if (m_mismatch) {
+    os << "  (unreliable: the bmv2 event messages do not match)" << std::endl;
+  }
+  os << "  table                              lookups    hit %";
+  if (m_timing) {
+    os << "  ns/lookup   time %";
+  }
+  os << std::endl;
+  for (const Table *table : tables) {
+    os << "  " << std::left << std::setw(30) << table->name << std::right
+       << std::setw(13) << table->lookups << std::setw(9) << std::setprecision(2)
+       << (table->lookups ? 100.0 * table->hits / table->lookups : 0);
+    if (m_timing) {
+      os << std::setw(11) << std::setprecision(1)
+         << (table->lookups && rate > 0 ? 1e9 * table->ticks / rate / table->lookups : 0)
+         << std::setw(9) << std::setprecision(2)
+         << (total_ticks ? 100.0 * table->ticks / total_ticks : 0);
+    }
+    os << std::endl;
+  }
+
+  std::vector<const Action *> actions;
+  for (const auto &action : m_actions) {
+    if (!action.name.empty() || action.calls != 0) {
+      actions.push_back(&action);
+    }
+  }
+  std::stable_sort(actions.begin(), actions.end(), [](const Action *a, const Action *b) {
+    return a->calls > b->calls;
+  });
+  os << "  action                               calls" << std::endl;
+  for (const Action *action : actions) {
+    os << "  " << std::left << std::setw(30) << action->name << std::right
+       << std::setw(13) << action->calls << std::endl;
+  }
+  os.flags(flags);
+  os.precision(precision);
+}
+
+} // namespace ns3
@@ -0,0 +1,159 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_TABLE_STATS_H
+#define P4_TABLE_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Json {
+class Value;
+}
+
+namespace ns3 {
+
+/**
+ * @brief Lookups, hits and actions of the match-action tables of one P4
+ * switch, and optionally the CPU time of every table.
+ *
+ * The counts come from the bmv2 event logger, which is global to the
+ * process: the first P4TableStatistics replaces its transport, for every
+ * switch and for the rest of the run, with one which decodes the table hit,
+ * table miss and action messages (so bmv2 must be built with its event
+ * logger, the default). bmv2 cannot hand over the transport it replaces, so
+ * the events are forwarded to \p event_logger_addr instead (nanomsg), the
+ * address the event logger was configured with; without it they only feed
+ * the statistics. A later bm::EventLogger::init() stops the counts. The
+ * events go to the statistics attached by the P4TableStatsScope around the
+ * pipeline being applied, and are dropped outside of a scope.
+ *
+ * bmv2 has no interface for the lookups of a table (its counters are per
+ * entry, and only for the tables which declare them), hence the decoding of
+ * the messages, whose layout is private to bmv2. Every pipeline applied in a
+ * scope must decode exactly one pipeline start message: otherwise the
+ * layout does not match the bmv2 in use (or its event logger is compiled
+ * out), a warning is logged and Report() flags the counts as unreliable.
+ *
+ * With timing, a table is charged the time from the previous table result
+ * (or the start of the pipeline) to its own result: its lookup, with the
+ * conditions and the action of the previous table before it. The time
+ * after the last result of a pipeline goes to the last table.
+ */
+class P4TableStatistics {
+public:
+  struct Table {
+    std::string name;
+    uint64_t lookups{0};
+    uint64_t hits{0};   //!< the misses are the other lookups
+    uint64_t ticks{0};  //!< with timing, see P4StageProfiler::ticks()
+  };
+
+  struct Action {
+    std::string name;
+    uint64_t calls{0};
+  };
+
+  /**
+   * @param config the bmv2 JSON of the switch (see ParseP4Json), for the
+   * names of the tables and actions
+   * @param timing whether to time the tables
+   * @param event_logger_addr where the events still go, empty for none
+   */
+  P4TableStatistics(const Json::Value &config, bool timing,
+                    const std::string &event_logger_addr = "");
+
+  //! Tables and actions by bmv2 id.
+  const std::vector<Table> &GetTables() const;
+  const std::vector<Action> &GetActions() const;
+  bool IsTiming() const;
+
+  void Reset();
+
+  //! One line per table (lookups, hit ratio, and with timing ns per lookup
+  //! and share of the table time), then one per action, busiest first.
+  void Report(std::ostream &os, const std::string &title) const;
+
+  //! Decode one message of the bmv2 event logger.
+  void Receive(const char *msg, int len);
+
+  //! Whether a pipeline was applied without its pipeline start message.
+  bool IsMismatched() const;
+
+  // events of the pipeline, see P4TableStatsScope
+  void BeginPipeline();
+  void EndPipeline();
+  void TableLookup(int table_id, bool hit);
+  void ActionCall(int action_id);
+
+  //! The statistics which get the events of the event logger, or null.
+  static P4TableStatistics *Current();
+
+private:
+  friend class P4TableStatsScope;
+
+  Table &GetTable(int table_id);
+
+  static P4TableStatistics *s_current;
+
+  std::vector<Table> m_tables;
+  std::vector<Action> m_actions;
+  bool m_timing;
+  uint64_t m_lastTicks{0};
+  size_t m_lastTable{0};    //!< index + 1 of the last table of the pipeline, 0 if none
+  uint64_t m_pipelines{0};  //!< pipelines applied in a scope
+  uint64_t m_pipelineStarts{0};
+  bool m_mismatch{false};
+  uint64_t m_startTicks;    //!< converts the ticks to seconds, as P4StageProfiler
+  std::chrono::steady_clock::time_point m_startTime;
+};
+
+/**
+ * @brief Send the table events of the pipeline applied during the life of
+ * the scope to \p stats, no-op (one branch) when \p stats is null.
+ */
+class P4TableStatsScope {
+public:
+  explicit P4TableStatsScope(P4TableStatistics *stats) : m_stats(stats) {
+    if (m_stats) {
+      P4TableStatistics::s_current = m_stats;
+      m_stats->BeginPipeline();
+    }
+  }
+
+  ~P4TableStatsScope() {
+    if (m_stats) {
+      m_stats->EndPipeline();
+      P4TableStatistics::s_current = nullptr;
+    }
+  }
+
+private:
+  P4TableStatsScope(const P4TableStatsScope &);
+  P4TableStatsScope &operator=(const P4TableStatsScope &);
+
+  P4TableStatistics *m_stats;
+};
+
+} // namespace ns3
+
+#endif // !P4_TABLE_STATS_H
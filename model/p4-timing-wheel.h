@@ -0,0 +1,174 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+#ifndef P4_TIMING_WHEEL_H
+#define P4_TIMING_WHEEL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * @brief A hierarchical timing wheel over 64-bit ticks, holding small
+ * integer handles (e.g. the index of an egress queue).
+ *
+ * Every handle is in the wheel at most once, with a key (tick, seq). The
+ * wheel has 11 levels of 64 slots each. A handle is placed on the level of
+ * the highest 6-bit digit in which its tick differs from the wheel cursor, so
+ * insert() and erase() are O(1). peek() returns the handle with the smallest
+ * (tick, seq): the lowest non empty level-0 slot holds it, and if level 0 is
+ * empty the lowest slot of the next level is cascaded down first (each entry
+ * moves down at most 10 times in its life). A slot with several entries is
+ * scanned for the smallest seq, since ticks may be equal.
+ *
+ * Ticks smaller than the cursor (which may run ahead of the simulation time
+ * after a peek()) are kept in the cursor slot of level 0 with their real key,
+ * so the order is still exact.
+ */
+class TimingWheel {
+ public:
+  using handle_t = uint32_t;
+
+  TimingWheel() {
+    for (auto &level : heads) level.fill(handle_t(kNil));
+    bitmaps.fill(0);
+  }
+
+  //! Insert \p handle with key (\p tick, \p seq), \p handle must not be in
+  //! the wheel already.
+  void insert(handle_t handle, uint64_t tick, uint64_t seq) {
+    if (handle >= nodes.size()) nodes.resize(handle + 1);
+    Node &node = nodes[handle];
+    node.tick = tick;
+    node.seq = seq;
+    link(handle);
+    count++;
+  }
+
+  //! Remove \p handle, no-op if it is not in the wheel.
+  void erase(handle_t handle) {
+    if (!contains(handle)) return;
+    unlink(handle);
+    count--;
+  }
+
+  bool contains(handle_t handle) const {
+    return handle < nodes.size() && nodes[handle].linked;
+  }
+
+  bool empty() const { return count == 0; }
+
+  size_t size() const { return count; }
+
+  //! Get the handle with the smallest (tick, seq), return false if empty.
+  bool peek(handle_t *handle) {
+    if (count == 0) return false;
+    while (bitmaps[0] == 0) cascade();
+    handle_t best = heads[0][ctz(bitmaps[0])];
+    for (handle_t h = nodes[best].next; h != kNil; h = nodes[h].next) {
+      if (before(nodes[h], nodes[best])) best = h;
+    }
+    *handle = best;
+    return true;
+  }
+
+  uint64_t get_tick(handle_t handle) const { return nodes[handle].tick; }
+
+ private:
+  static constexpr unsigned kBits = 6;
+  static constexpr unsigned kSlots = 1u << kBits;
+  static constexpr unsigned kLevels = (64 + kBits - 1) / kBits;
+  static constexpr handle_t kNil = static_cast<handle_t>(-1);
+
+  struct Node {
+    uint64_t tick{0};
+    uint64_t seq{0};
+    handle_t prev{kNil};
+    handle_t next{kNil};
+    uint8_t level{0};
+    uint8_t slot{0};
+    bool linked{false};
+  };
+
+  static unsigned ctz(uint64_t x) { return __builtin_ctzll(x); }
+
+  static bool before(const Node &a, const Node &b) {
+    return (a.tick == b.tick) ? a.seq < b.seq : a.tick < b.tick;
+  }
+
+  void link(handle_t handle) {
+    Node &node = nodes[handle];
+    unsigned level = 0;
+    unsigned slot = cursor & (kSlots - 1);
+    if (node.tick > cursor) {
+      level = (63 - __builtin_clzll(node.tick ^ cursor)) / kBits;
+      slot = (node.tick >> (level * kBits)) & (kSlots - 1);
+    }
+    node.level = level;
+    node.slot = slot;
+    node.prev = kNil;
+    node.next = heads[level][slot];
+    if (node.next != kNil) nodes[node.next].prev = handle;
+    heads[level][slot] = handle;
+    bitmaps[level] |= uint64_t(1) << slot;
+    node.linked = true;
+  }
+
+  void unlink(handle_t handle) {
+    Node &node = nodes[handle];
+    if (node.prev != kNil) nodes[node.prev].next = node.next;
+    else heads[node.level][node.slot] = node.next;
+    if (node.next != kNil) nodes[node.next].prev = node.prev;
+    if (heads[node.level][node.slot] == kNil)
+      bitmaps[node.level] &= ~(uint64_t(1) << node.slot);
+    node.linked = false;
+  }
+
+  //! Move the cursor to the start of the lowest non empty slot of the lowest
+  //! non empty level and spread the entries of this slot on the lower levels.
+  void cascade() {
+    unsigned level = 1;
+    while (bitmaps[level] == 0) level++;
+    unsigned slot = ctz(bitmaps[level]);
+    unsigned shift = (level + 1) * kBits;
+    uint64_t low_mask = (shift >= 64) ? ~uint64_t(0) : (uint64_t(1) << shift) - 1;
+    cursor = (cursor & ~low_mask) | (uint64_t(slot) << (level * kBits));
+    handle_t h = heads[level][slot];
+    heads[level][slot] = kNil;
+    bitmaps[level] &= ~(uint64_t(1) << slot);
+    while (h != kNil) {
+      handle_t next = nodes[h].next;
+      link(h);
+      h = next;
+    }
+  }
+
+  std::vector<Node> nodes{};
+  std::array<std::array<handle_t, kSlots>, kLevels> heads;
+  std::array<uint64_t, kLevels> bitmaps;
+  uint64_t cursor{0};
+  size_t count{0};
+};
+
+} // namespace ns3
+
+#endif // !P4_TIMING_WHEEL_H
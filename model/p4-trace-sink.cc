@@ -0,0 +1,103 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+
+#include "ns3/p4-trace-sink.h"
+
+namespace ns3 {
+
+const char P4TraceSink::kMagic[8] = {'p', '4', 't', 'r', 'a', 'c', 'e', '1'};
+
+P4TraceSink::P4TraceSink(const std::string &path, size_t block_records, size_t blocks)
+    : m_file(std::fopen(path.c_str(), "wb")),
+      m_ring(block_records * blocks),
+      m_blockRecords(block_records),
+      m_blocks(blocks) {
+  if (m_file == nullptr)
+    return;
+  std::fwrite(kMagic, sizeof(kMagic), 1, m_file);
+  m_writer = std::thread(&P4TraceSink::WriterLoop, this);
+}
+
+P4TraceSink::~P4TraceSink() { Close(); }
+
+bool P4TraceSink::IsOpen() const { return m_file != nullptr; }
+
+void P4TraceSink::Record(uint32_t event, uint32_t switch_id, int64_t time,
+                         int64_t packet_id, int64_t priority) {
+  if (m_file == nullptr)
+    return;
+  P4TraceRecord &record = m_ring[m_current * m_blockRecords + m_fill];
+  record.event = event;
+  record.switchId = switch_id;
+  record.time = time;
+  record.packetId = packet_id;
+  record.priority = priority;
+  if (++m_fill == m_blockRecords)
+    Handoff();
+}
+
+// give the current block to the writer and wait until the next one is free
+void P4TraceSink::Handoff() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_full.push_back(std::make_pair(m_current, m_fill));
+  m_pending++;
+  m_cv.notify_all();
+  // the blocks are written in order, the next one is the oldest pending
+  m_cv.wait(lock, [this] { return m_pending < m_blocks; });
+  m_current = (m_current + 1) % m_blocks;
+  m_fill = 0;
+}
+
+void P4TraceSink::WriterLoop() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_cv.wait(lock, [this] { return !m_full.empty() || m_closing; });
+    if (m_full.empty())
+      return;
+    std::pair<size_t, size_t> block = m_full.front();
+    m_full.pop_front();
+    lock.unlock();
+    std::fwrite(&m_ring[block.first * m_blockRecords], sizeof(P4TraceRecord),
+                block.second, m_file);
+    lock.lock();
+    m_pending--;
+    m_cv.notify_all();
+  }
+}
+
+void P4TraceSink::Close() {
+  if (m_file == nullptr)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fill != 0) {
+      m_full.push_back(std::make_pair(m_current, m_fill));
+      m_pending++;
+      m_fill = 0;
+    }
+    m_closing = true;
+    m_cv.notify_all();
+  }
+  m_writer.join();
+  std::fclose(m_file);
+  m_file = nullptr;
+}
+
+} // namespace ns3
@@ -0,0 +1,104 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+* Copyright (c) YEAR COPYRIGHTHOLDER
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License version 2 as
+* published by the Free Software Foundation;
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*
+* Author:
+*/
+
+#ifndef P4_TRACE_SINK_H
+#define P4_TRACE_SINK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+// Per-packet events of a P4 switch (P4GlobalVar::ns3_p4_tracing_dalay_sim)
+enum P4TraceEvent {
+  P4_TRACE_SWITCH_IN = 0,  //!< "SimIn", received by the switch
+  P4_TRACE_QUEUE_IN = 1,   //!< "SimQIn", enqueued in an egress queue
+  P4_TRACE_QUEUE_OUT = 2,  //!< "SimQOut", dequeued from an egress queue
+  P4_TRACE_SWITCH_OUT = 3  //!< "SimOut", sent by the switch
+};
+
+/**
+ * @brief One record of a binary trace file, 32 bytes in host byte order.
+ * examples/p4-trace-to-csv.py turns a trace file into the csv files.
+ */
+struct P4TraceRecord {
+  uint32_t event;     //!< P4TraceEvent
+  uint32_t switchId;
+  int64_t time;       //!< simulation time in ns
+  int64_t packetId;   //!< bm packet id
+  int64_t priority;   //!< standard_metadata.priority, -1 if unknown
+};
+
+/**
+ * @brief Buffered binary trace file of one P4 switch.
+ *
+ * Record() copies a record into the current block of a ring allocated
+ * once, and every full block goes to a writer thread which appends it to
+ * the file. The simulation only waits for the disk when all the blocks
+ * of the ring wait to be written. Close() writes the last block and ends
+ * the writer, the destructor closes the file if needed.
+ */
+class P4TraceSink {
+public:
+  static const char kMagic[8];  //!< first bytes of a trace file
+
+  P4TraceSink(const std::string &path, size_t block_records = 4096, size_t blocks = 16);
+  ~P4TraceSink();
+
+  bool IsOpen() const;
+
+  void Record(uint32_t event, uint32_t switch_id, int64_t time, int64_t packet_id,
+              int64_t priority);
+
+  void Close();
+
+private:
+  P4TraceSink(const P4TraceSink &);
+  P4TraceSink &operator=(const P4TraceSink &);
+
+  void Handoff();
+  void WriterLoop();
+
+  std::FILE *m_file;
+  std::vector<P4TraceRecord> m_ring;  //!< m_blocks blocks of m_blockRecords
+  size_t m_blockRecords;
+  size_t m_blocks;
+  size_t m_current{0};  //!< block being filled
+  size_t m_fill{0};     //!< records in the current block
+  size_t m_pending{0};  //!< blocks given to the writer and not written yet
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::pair<size_t, size_t>> m_full;  //!< (block, records) to write
+  bool m_closing{false};
+  std::thread m_writer;
+};
+
+} // namespace ns3
+
+#endif // !P4_TRACE_SINK_H
@@ -2,6 +2,30 @@
 
 // An essential include is test.h
 #include "ns3/test.h"
+#include "ns3/helper.h"
+#include "ns3/p4-address-table.h"
+#include "ns3/p4-burst-clock.h"
+#include "ns3/p4-histogram.h"
+#include "ns3/p4-packet-context.h"
+#include "ns3/p4-queue-policy.h"
+#include "ns3/p4-queueing-logic.h"
+#include "ns3/p4-stage-profiler.h"
+#include "ns3/p4-table-stats.h"
+#include "ns3/p4-timing-wheel.h"
+#include "ns3/p4-trace-sink.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
 
 // Do not put your test classes in namespace ns3.  You may find it useful
 // to use the using directive to access the ns3 namespace directly
@@ -43,6 +67,932 @@ P4TestCase1::DoRun (void)
   NS_TEST_ASSERT_MSG_EQ_TOL (0.01, 0.01, 0.001, "Numbers are not equal within tolerance");
 }
 
+// The TimingWheel must always return the same handle as an ordered set
+// keyed by (tick, seq), including ticks that fall behind its cursor.
+class P4TimingWheelTestCase : public TestCase
+{
+public:
+  P4TimingWheelTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4TimingWheelTestCase::P4TimingWheelTestCase ()
+  : TestCase ("Check the TimingWheel order against a std::set")
+{
+}
+
+void
+P4TimingWheelTestCase::DoRun (void)
+{
+  typedef std::pair<std::pair<uint64_t, uint64_t>, uint32_t> Entry;
+  TimingWheel wheel;
+  std::set<Entry> reference;
+  std::vector<Entry> entries (64);
+  uint64_t now = 0;
+  uint64_t seq = 0;
+  srand (1);
+  for (int i = 0; i < 100000; i++)
+    {
+      uint32_t handle = rand () % entries.size ();
+      if (wheel.contains (handle))
+        {
+          wheel.erase (handle);
+          reference.erase (entries[handle]);
+        }
+      else
+        {
+          // mostly near future, sometimes far away or in the past
+          uint64_t delta = (rand () % 8 == 0) ? (uint64_t (rand ()) << 20) : rand () % 5000;
+          uint64_t tick = (rand () % 16 == 0 && now > delta) ? now - delta : now + delta;
+          entries[handle] = Entry (std::make_pair (tick, seq++), handle);
+          wheel.insert (handle, tick, entries[handle].first.second);
+          reference.insert (entries[handle]);
+        }
+      uint32_t first;
+      NS_TEST_ASSERT_MSG_EQ (wheel.peek (&first), !reference.empty (), "wrong emptiness");
+      if (!reference.empty ())
+        {
+          NS_TEST_ASSERT_MSG_EQ (first, reference.begin ()->second, "wrong first handle");
+          now = reference.begin ()->first.first;
+        }
+    }
+}
+
+// FifoRing keeps the FIFO order when it grows while wrapped around.
+class P4FifoRingTestCase : public TestCase
+{
+public:
+  P4FifoRingTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4FifoRingTestCase::P4FifoRingTestCase ()
+  : TestCase ("Check the FifoRing order across growth")
+{
+}
+
+void
+P4FifoRingTestCase::DoRun (void)
+{
+  FifoRing<int> ring (4);
+  int next_in = 0;
+  int next_out = 0;
+  for (int round = 0; round < 100; round++)
+    {
+      for (int i = 0; i < round % 7 + 1; i++)
+        {
+          ring.push_back (int (next_in++));
+        }
+      for (int i = 0; i < round % 5 && !ring.empty (); i++)
+        {
+          NS_TEST_ASSERT_MSG_EQ (ring.front (), next_out++, "wrong FIFO order");
+          ring.pop_front ();
+        }
+    }
+  NS_TEST_ASSERT_MSG_EQ (ring.size (), size_t (next_in - next_out), "wrong size");
+}
+
+// The stage latency model counts one match-action stage per table.
+class P4PipelineTablesTestCase : public TestCase
+{
+public:
+  P4PipelineTablesTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4PipelineTablesTestCase::P4PipelineTablesTestCase ()
+  : TestCase ("Count the tables of the pipelines of a bmv2 JSON")
+{
+}
+
+void
+P4PipelineTablesTestCase::DoRun (void)
+{
+  Json::Value config = ParseP4Json ("{\"header_types\": [{\"name\": \"ingress\", \"fields\": []}],"
+                       " \"pipelines\": [{\"name\": \"ingress\", \"init_table\": \"t0\","
+                       " \"tables\": [{\"name\": \"t0\", \"key\": [{\"target\": [\"a]\", \"b\"]}]},"
+                       " {\"name\": \"t1\", \"next_tables\": {\"x\": null}}]},"
+                       " {\"name\": \"egress\", \"tables\": []}]}");
+  NS_TEST_ASSERT_MSG_EQ (CountP4PipelineTables (config, "ingress"), 2u, "wrong ingress tables");
+  NS_TEST_ASSERT_MSG_EQ (CountP4PipelineTables (config, "egress"), 0u, "wrong egress tables");
+  NS_TEST_ASSERT_MSG_EQ (CountP4PipelineTables (config, "other"), 0u, "unknown pipeline");
+  NS_TEST_ASSERT_MSG_EQ (CountP4PipelineTables (ParseP4Json ("{\"pipelines\": ["), "ingress"), 0u,
+                         "invalid JSON");
+}
+
+// The table statistics name the tables and actions by bmv2 id.
+class P4ObjectNamesTestCase : public TestCase
+{
+public:
+  P4ObjectNamesTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4ObjectNamesTestCase::P4ObjectNamesTestCase ()
+  : TestCase ("Name the tables and actions of a bmv2 JSON by id")
+{
+}
+
+void
+P4ObjectNamesTestCase::DoRun (void)
+{
+  Json::Value config = ParseP4Json ("{\"actions\": [{\"name\": \"fwd\", \"id\": 0, \"runtime_data\": []},"
+                       " {\"name\": \"drop\", \"id\": 3}],"
+                       " \"pipelines\": [{\"name\": \"ingress\", \"tables\": [{\"name\": \"lpm\", \"id\": 0},"
+                       " {\"name\": \"acl\", \"id\": 1}]},"
+                       " {\"name\": \"egress\", \"tables\": [{\"name\": \"rewrite\", \"id\": 2}]}]}");
+  std::map<int, std::string> tables = P4TableNames (config);
+  NS_TEST_ASSERT_MSG_EQ (tables.size (), 3u, "wrong tables");
+  NS_TEST_ASSERT_MSG_EQ (tables[1], "acl", "wrong ingress table");
+  NS_TEST_ASSERT_MSG_EQ (tables[2], "rewrite", "wrong egress table");
+  std::map<int, std::string> actions = P4ActionNames (config);
+  NS_TEST_ASSERT_MSG_EQ (actions.size (), 2u, "wrong actions");
+  NS_TEST_ASSERT_MSG_EQ (actions[3], "drop", "wrong action");
+  NS_TEST_ASSERT_MSG_EQ (P4TableNames (ParseP4Json ("{}")).empty (), true, "no pipelines");
+}
+
+// A message of the bmv2 event logger (src/bm_sim/event_logger.cpp): type,
+// switch and context ids, packet signature, id and copy id, then \p ids.
+static std::string
+P4EventMessage (int type, const std::vector<int> &ids)
+{
+  std::string msg;
+  int header[3] = {type, 0, 0};
+  uint64_t packet[3] = {0, 1, 0};
+  msg.append (reinterpret_cast<const char *> (header), sizeof (header));
+  msg.append (reinterpret_cast<const char *> (packet), sizeof (packet));
+  for (int id : ids)
+    {
+      msg.append (reinterpret_cast<const char *> (&id), sizeof (id));
+    }
+  return msg;
+}
+
+// The table statistics count the table and action messages of the
+// pipelines, and flag the messages which do not match their layout.
+class P4TableStatisticsTestCase : public TestCase
+{
+public:
+  P4TableStatisticsTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4TableStatisticsTestCase::P4TableStatisticsTestCase ()
+  : TestCase ("Check the counts of the P4TableStatistics")
+{
+}
+
+void
+P4TableStatisticsTestCase::DoRun (void)
+{
+  std::string config = "{\"actions\": [{\"name\": \"fwd\", \"id\": 0}, {\"name\": \"drop\", \"id\": 1}],"
+                       " \"pipelines\": [{\"name\": \"ingress\", \"tables\": [{\"name\": \"lpm\", \"id\": 0},"
+                       " {\"name\": \"acl\", \"id\": 1}]}]}";
+  P4TableStatistics stats (ParseP4Json (config), false);
+  // ingress: lpm hits (entry 7) and forwards, acl misses and drops
+  const std::string pipeline[5] = {P4EventMessage (9, {0}), P4EventMessage (12, {0, 7}),
+                                   P4EventMessage (14, {0}), P4EventMessage (13, {1}),
+                                   P4EventMessage (14, {1})};
+  for (int i = 0; i < 3; i++)
+    {
+      P4TableStatsScope scope (&stats);
+      NS_TEST_ASSERT_MSG_EQ (P4TableStatistics::Current (), &stats, "scope not attached");
+      for (const std::string &msg : pipeline)
+        {
+          stats.Receive (msg.data (), int (msg.size ()));
+        }
+    }
+  NS_TEST_ASSERT_MSG_EQ (P4TableStatistics::Current (), (P4TableStatistics *) nullptr,
+                         "scope not detached");
+  const std::vector<P4TableStatistics::Table> &tables = stats.GetTables ();
+  NS_TEST_ASSERT_MSG_EQ (tables.size (), 2u, "wrong tables");
+  NS_TEST_ASSERT_MSG_EQ (tables[0].name, "lpm", "wrong table name");
+  NS_TEST_ASSERT_MSG_EQ (tables[0].lookups, 3u, "wrong lookups");
+  NS_TEST_ASSERT_MSG_EQ (tables[0].hits, 3u, "wrong hits");
+  NS_TEST_ASSERT_MSG_EQ (tables[1].lookups, 3u, "wrong lookups");
+  NS_TEST_ASSERT_MSG_EQ (tables[1].hits, 0u, "miss counted as a hit");
+  NS_TEST_ASSERT_MSG_EQ (stats.GetActions ()[0].calls, 3u, "wrong action calls");
+  NS_TEST_ASSERT_MSG_EQ (stats.GetActions ()[1].calls, 3u, "wrong action calls");
+  NS_TEST_ASSERT_MSG_EQ (stats.IsMismatched (), false, "layout reported as mismatched");
+
+  // a truncated message is ignored
+  std::string truncated = P4EventMessage (13, {});
+  stats.Receive (truncated.data (), int (truncated.size ()));
+  NS_TEST_ASSERT_MSG_EQ (tables[1].lookups, 3u, "truncated message counted");
+
+  std::ostringstream report;
+  stats.Report (report, "tables");
+  NS_TEST_ASSERT_MSG_NE (report.str ().find ("acl"), std::string::npos, "table not reported");
+  NS_TEST_ASSERT_MSG_NE (report.str ().find ("drop"), std::string::npos, "action not reported");
+
+  stats.Reset ();
+  NS_TEST_ASSERT_MSG_EQ (stats.GetTables ()[0].lookups, 0u, "lookups not reset");
+  NS_TEST_ASSERT_MSG_EQ (stats.GetActions ()[1].calls, 0u, "calls not reset");
+
+  // a pipeline without its start message: the layout does not match
+  {
+    P4TableStatsScope scope (&stats);
+    stats.Receive (pipeline[1].data (), int (pipeline[1].size ()));
+  }
+  NS_TEST_ASSERT_MSG_EQ (stats.IsMismatched (), true, "mismatch not detected");
+  report.str ("");
+  stats.Report (report, "tables");
+  NS_TEST_ASSERT_MSG_NE (report.str ().find ("unreliable"), std::string::npos,
+                         "mismatch not reported");
+}
+
+// The packet headroom covers every header the deparser may emit.
+class P4DeparserBytesTestCase : public TestCase
+{
+public:
+  P4DeparserBytesTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4DeparserBytesTestCase::P4DeparserBytesTestCase ()
+  : TestCase ("Count the bytes of the deparsed headers of a bmv2 JSON")
+{
+}
+
+void
+P4DeparserBytesTestCase::DoRun (void)
+{
+  Json::Value config = ParseP4Json ("{\"header_types\": ["
+                       "{\"name\": \"eth_t\", \"fields\": [[\"dst\", 48, false], [\"src\", 48, false],"
+                       " [\"type\", 16, false]]},"
+                       "{\"name\": \"opt_t\", \"max_length\": 40, \"fields\": [[\"len\", 4, false],"
+                       " [\"data\", \"*\"]]},"
+                       "{\"name\": \"meta_t\", \"max_length\": null, \"fields\": [[\"x\", 3, false]]}],"
+                       " \"headers\": [{\"name\": \"eth\", \"header_type\": \"eth_t\", \"metadata\": false},"
+                       " {\"name\": \"opt\", \"header_type\": \"opt_t\", \"metadata\": false},"
+                       " {\"name\": \"meta\", \"header_type\": \"meta_t\", \"metadata\": true}],"
+                       " \"deparsers\": [{\"name\": \"deparser\", \"order\": [\"eth\", \"opt\"]}]}");
+  NS_TEST_ASSERT_MSG_EQ (CountP4DeparserBytes (config), 54u, "wrong deparser bytes");
+  NS_TEST_ASSERT_MSG_EQ (CountP4DeparserBytes (ParseP4Json ("{}")), 0u, "no deparser");
+}
+
+// The payload is only kept out of the bm packet when the program never reads
+// past its headers.
+class P4ReadsPayloadTestCase : public TestCase
+{
+public:
+  P4ReadsPayloadTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4ReadsPayloadTestCase::P4ReadsPayloadTestCase ()
+  : TestCase ("Find the bmv2 JSONs which read the payload")
+{
+}
+
+void
+P4ReadsPayloadTestCase::DoRun (void)
+{
+  std::string extract = "{\"op\": \"extract\", \"parameters\": [{\"type\": \"regular\", \"value\": \"eth\"}]}";
+  std::string parser = "{\"parsers\": [{\"name\": \"parser\", \"parse_states\": ["
+                       "{\"name\": \"start\", \"parser_ops\": [" + extract + "%s],"
+                       " \"transition_key\": [%s], \"transitions\": []}]}],"
+                       " \"actions\": [{\"name\": \"fwd\", \"primitives\": [{\"op\": \"assign\"}]}]}";
+  auto program = [&parser] (const std::string &op, const std::string &key) {
+    std::string config = parser;
+    config.replace (config.find ("%s"), 2, op);
+    config.replace (config.find ("%s"), 2, key);
+    return ParseP4Json (config);
+  };
+  NS_TEST_ASSERT_MSG_EQ (P4ProgramReadsPayload (program ("", "")), false, "headers only");
+  NS_TEST_ASSERT_MSG_EQ (P4ProgramReadsPayload (program (", {\"op\": \"advance\", \"parameters\": []}", "")),
+                         true, "advance");
+  NS_TEST_ASSERT_MSG_EQ (P4ProgramReadsPayload (program (", {\"op\": \"shift\", \"parameters\": []}", "")),
+                         true, "shift");
+  NS_TEST_ASSERT_MSG_EQ (P4ProgramReadsPayload (program ("", "{\"type\": \"lookahead\", \"value\": [0, 8]}")),
+                         true, "lookahead");
+  NS_TEST_ASSERT_MSG_EQ (P4ProgramReadsPayload (ParseP4Json ("{\"calculations\": [{\"name\": \"c\","
+                                                             " \"input\": [{\"type\": \"payload\"}]}]}")),
+                         true, "payload checksum");
+  NS_TEST_ASSERT_MSG_EQ (P4ProgramReadsPayload (ParseP4Json ("{\"actions\": [{\"name\": \"t\","
+                                                             " \"primitives\": [{\"op\": \"truncate\"}]}]}")),
+                         true, "truncate");
+  NS_TEST_ASSERT_MSG_EQ (P4ProgramReadsPayload (ParseP4Json ("{}")), false, "empty program");
+}
+
+// The slab answers only for the generation in a slot, and grows instead of
+// overwriting a live record.
+class P4PacketContextSlabTestCase : public TestCase
+{
+public:
+  P4PacketContextSlabTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4PacketContextSlabTestCase::P4PacketContextSlabTestCase ()
+  : TestCase ("Check the PacketContextSlab generations, references and growth")
+{
+}
+
+void
+P4PacketContextSlabTestCase::DoRun (void)
+{
+  PacketContextSlab<int> slab (4, 8);
+  *slab.insert (1) = 10;
+  slab.acquire (1);
+  *slab.insert (2) = 20;
+  NS_TEST_ASSERT_MSG_EQ (slab.size (), 2u, "wrong live records");
+  NS_TEST_ASSERT_MSG_EQ (slab.find (5) == nullptr, true, "answered for another generation");
+  slab.release (1);
+  NS_TEST_ASSERT_MSG_EQ (*slab.find (1), 10, "record gone with a copy left");
+  slab.release (1);
+  NS_TEST_ASSERT_MSG_EQ (slab.find (1) == nullptr, true, "record left without copies");
+  // 2 is still live, 6 needs its slot: the ring grows
+  *slab.insert (6) = 60;
+  NS_TEST_ASSERT_MSG_EQ (slab.growths (), 1u, "ring not grown");
+  NS_TEST_ASSERT_MSG_EQ (slab.capacity (), 8u, "wrong capacity");
+  NS_TEST_ASSERT_MSG_EQ (*slab.find (2), 20, "live record lost in the growth");
+  NS_TEST_ASSERT_MSG_EQ (*slab.find (6), 60, "wrong record");
+  // 10 needs the slot of 2 in the full size ring
+  NS_TEST_ASSERT_MSG_EQ (slab.insert (10) == nullptr, true, "grown past the maximum");
+  NS_TEST_ASSERT_MSG_EQ (*slab.find (2), 20, "live record overwritten");
+  slab.release (2);
+  NS_TEST_ASSERT_MSG_EQ (slab.size (), 1u, "wrong live records after release");
+  NS_TEST_ASSERT_MSG_EQ (slab.insert (10) != nullptr, true, "free slot refused");
+}
+
+// Every value falls in a bucket whose bounds hold it, and the buckets are
+// at most 1/8 wider than their lower bound.
+class P4LogHistogramTestCase : public TestCase
+{
+public:
+  P4LogHistogramTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4LogHistogramTestCase::P4LogHistogramTestCase ()
+  : TestCase ("Check the P4LogHistogram buckets and quantiles")
+{
+}
+
+void
+P4LogHistogramTestCase::DoRun (void)
+{
+  std::vector<uint64_t> values = {0, 1, 7, 8, 9, 15, 16, 17, 1000, 123456789, UINT64_MAX};
+  for (int i = 0; i < 1000; i++)
+    {
+      values.push_back ((uint64_t (std::rand ()) << 31) ^ std::rand ());
+    }
+  for (uint64_t v : values)
+    {
+      size_t b = P4LogHistogram::bucket_of (v);
+      NS_TEST_ASSERT_MSG_LT (b, P4LogHistogram::kBuckets, "bucket out of range");
+      NS_TEST_ASSERT_MSG_EQ (P4LogHistogram::bucket_low (b) <= v, true, "value below its bucket");
+      NS_TEST_ASSERT_MSG_EQ (v <= P4LogHistogram::bucket_high (b), true, "value above its bucket");
+      uint64_t low = P4LogHistogram::bucket_low (b);
+      NS_TEST_ASSERT_MSG_EQ ((P4LogHistogram::bucket_high (b) - low) <= low / 8, true,
+                             "bucket too wide");
+    }
+  P4LogHistogram h;
+  for (uint64_t v = 1; v <= 100; v++)
+    {
+      h.record (v);
+    }
+  NS_TEST_ASSERT_MSG_EQ (h.count (), 100u, "wrong count");
+  NS_TEST_ASSERT_MSG_EQ (h.min (), 1u, "wrong min");
+  NS_TEST_ASSERT_MSG_EQ (h.max (), 100u, "wrong max");
+  NS_TEST_ASSERT_MSG_EQ (h.quantile (0.5), 48u, "wrong median bucket");  // [48, 51]
+  NS_TEST_ASSERT_MSG_EQ (h.quantile (1.0), 96u, "wrong top bucket");     // [96, 103]
+  h.reset ();
+  NS_TEST_ASSERT_MSG_EQ (h.count (), 0u, "reset kept values");
+}
+
+// A timer charges one packet to its stage only with a profiler, and the
+// report of all the switches adds the stages up.
+class P4StageProfilerTestCase : public TestCase
+{
+public:
+  P4StageProfilerTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4StageProfilerTestCase::P4StageProfilerTestCase ()
+  : TestCase ("Check the P4StageProfiler counts and merge")
+{
+}
+
+void
+P4StageProfilerTestCase::DoRun (void)
+{
+  P4StageProfiler a, b;
+  for (int i = 0; i < 3; i++)
+    {
+      P4StageTimer timer (&a, P4_STAGE_PARSE);
+    }
+  {
+    P4StageTimer timer (nullptr, P4_STAGE_PARSE);
+  }
+  {
+    P4StageTimer timer (&b, P4_STAGE_PARSE);
+  }
+  {
+    P4StageTimer timer (&b, P4_STAGE_DEPARSE);
+  }
+  NS_TEST_ASSERT_MSG_EQ (a.calls (P4_STAGE_PARSE), 3u, "wrong parse count");
+  a.merge (b);
+  NS_TEST_ASSERT_MSG_EQ (a.calls (P4_STAGE_PARSE), 4u, "parse not merged");
+  NS_TEST_ASSERT_MSG_EQ (a.calls (P4_STAGE_DEPARSE), 1u, "deparse not merged");
+  NS_TEST_ASSERT_MSG_EQ (a.calls (P4_STAGE_INGRESS), 0u, "stage without timer counted");
+  // the queue operations of one packet count it once
+  {
+    P4StageTimer push (&a, P4_STAGE_QUEUE, false);
+  }
+  {
+    P4StageTimer pop (&a, P4_STAGE_QUEUE);
+  }
+  NS_TEST_ASSERT_MSG_EQ (a.calls (P4_STAGE_QUEUE), 1u, "queue operations counted as packets");
+}
+
+// The destinations are interned once, by type and bytes.
+class P4AddressTableTestCase : public TestCase
+{
+public:
+  P4AddressTableTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4AddressTableTestCase::P4AddressTableTestCase ()
+  : TestCase ("Check the P4AddressTable indices")
+{
+}
+
+void
+P4AddressTableTestCase::DoRun (void)
+{
+  const uint8_t bytes[6] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+  const uint8_t other[6] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x02};
+  Address a (1, bytes, 6);
+  Address b (2, bytes, 6);
+  Address c (1, other, 6);
+  P4AddressTable table;
+  uint32_t index = table.Intern (a);
+  NS_TEST_ASSERT_MSG_EQ (table.Intern (a), index, "Intern is not idempotent");
+  NS_TEST_ASSERT_MSG_EQ (table.Intern (Address (a)), index, "copy interned again");
+  NS_TEST_ASSERT_MSG_NE (table.Intern (b), index, "same bytes of another type share an index");
+  NS_TEST_ASSERT_MSG_NE (table.Intern (c), index, "other bytes share an index");
+  NS_TEST_ASSERT_MSG_EQ (table.GetSize (), 3u, "wrong number of addresses");
+  NS_TEST_ASSERT_MSG_EQ ((table.Get (index) == a), true, "Get (Intern (a)) != a");
+  NS_TEST_ASSERT_MSG_EQ ((table.Get (table.Intern (b)) == b), true, "Get (Intern (b)) != b");
+  NS_TEST_ASSERT_MSG_EQ ((table.Get (table.Intern (c)) == c), true, "Get (Intern (c)) != c");
+}
+
+// The trace sink hands full blocks to its writer thread, waits when the
+// whole ring is pending, and writes the partial last block on Close.
+class P4TraceSinkTestCase : public TestCase
+{
+public:
+  P4TraceSinkTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4TraceSinkTestCase::P4TraceSinkTestCase ()
+  : TestCase ("Check the P4TraceSink records and their order")
+{
+}
+
+void
+P4TraceSinkTestCase::DoRun (void)
+{
+  // 3 blocks of 7 records, the ring is reused many times and the last
+  // block is partial
+  const int64_t records = 1003;
+  std::string path = CreateTempDirFilename ("p4-trace-sink-test.bin");
+  {
+    P4TraceSink sink (path, 7, 3);
+    NS_TEST_ASSERT_MSG_EQ (sink.IsOpen (), true, "trace file not opened");
+    for (int64_t i = 0; i < records; i++)
+      {
+        sink.Record (i % 4, 5, 10 * i, i, i % 8);
+      }
+    sink.Close ();
+  }
+  std::FILE *file = std::fopen (path.c_str (), "rb");
+  NS_TEST_ASSERT_MSG_NE (file, nullptr, "trace file missing");
+  char magic[sizeof (P4TraceSink::kMagic)];
+  NS_TEST_ASSERT_MSG_EQ (std::fread (magic, sizeof (magic), 1, file), 1u, "no magic");
+  NS_TEST_ASSERT_MSG_EQ (std::memcmp (magic, P4TraceSink::kMagic, sizeof (magic)), 0, "wrong magic");
+  P4TraceRecord record;
+  int64_t read = 0;
+  while (std::fread (&record, sizeof (record), 1, file) == 1)
+    {
+      NS_TEST_ASSERT_MSG_EQ (record.packetId, read, "records out of order");
+      NS_TEST_ASSERT_MSG_EQ (record.event, uint32_t (read % 4), "wrong event");
+      NS_TEST_ASSERT_MSG_EQ (record.switchId, 5u, "wrong switch");
+      NS_TEST_ASSERT_MSG_EQ (record.time, 10 * read, "wrong time");
+      NS_TEST_ASSERT_MSG_EQ (record.priority, read % 8, "wrong priority");
+      read++;
+    }
+  std::fclose (file);
+  std::remove (path.c_str ());
+  NS_TEST_ASSERT_MSG_EQ (read, records, "records lost");
+}
+
+// All the logical queues of the tests below are served by one worker.
+struct P4TestWorkerMap
+{
+  size_t operator() (size_t /* queue_id */) const
+  {
+    return 0;
+  }
+};
+
+// Drains logical queue 0 as an egress port of P4Model does: pops up to
+// burst packets (all of them if 0) which may leave now, each one service
+// after the previous one, then waits for the next departure and for the
+// port to be free.
+class P4QueueDrain
+{
+public:
+  explicit P4QueueDrain (size_t priorities)
+    : queue (1, 64, P4TestWorkerMap (), priorities),
+      burst (0)
+  {
+  }
+
+  void Drain (void)
+  {
+    size_t processed = 0;
+    clock.start (service);
+    while (burst == 0 || processed < burst)
+      {
+        int item = -1;
+        size_t priority;
+        queue.pop_back_queue (0, &priority, &item);
+        if (item < 0)
+          {
+            break;
+          }
+        if (clock.offset ().IsZero ())
+          {
+            Depart ();
+          }
+        else
+          {
+            Simulator::Schedule (clock.offset (), &P4QueueDrain::Depart, this);
+          }
+        processed++;
+        clock.advance ();
+      }
+    clock.stop ();
+    Time next;
+    if (queue.get_queue_next_departure (0, &next))
+      {
+        Time free = Simulator::Now () + TimeStep (service.GetTimeStep () * processed);
+        Simulator::Schedule (std::max (next, free) - Simulator::Now (), &P4QueueDrain::Drain,
+                             this);
+      }
+  }
+
+  //! Push packets of \p bytes at t=0, start to drain at \p start and
+  //! return their departure times (ns).
+  std::vector<int64_t> Run (const std::vector<size_t> &bytes, Time start = Seconds (0))
+  {
+    for (size_t i = 0; i < bytes.size (); i++)
+      {
+        queue.push_front (0, 0, bytes[i], int (i));
+      }
+    Simulator::Schedule (start, &P4QueueDrain::Drain, this);
+    Simulator::Run ();
+    Simulator::Destroy ();
+    return departures;
+  }
+
+  NSQueueingLogicPriRL<int, P4TestWorkerMap> queue;
+  size_t burst;
+  Time service;
+  std::vector<int64_t> departures;
+
+private:
+  void Depart (void)
+  {
+    departures.push_back (Simulator::Now ().GetNanoSeconds ());
+  }
+
+  P4BurstClock clock;
+};
+
+// The token bucket of an egress queue charges every packet its length.
+class P4TokenBucketTestCase : public TestCase
+{
+public:
+  P4TokenBucketTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4TokenBucketTestCase::P4TokenBucketTestCase ()
+  : TestCase ("Check the departure times of the egress token bucket")
+{
+}
+
+void
+P4TokenBucketTestCase::DoRun (void)
+{
+  // 1 Gb/s and a 1500 byte bucket: the first packet takes the full bucket,
+  // the next ones wait 12 us each
+  {
+    P4QueueDrain drain (1);
+    drain.queue.set_rate_bps (0, 1000000000, 1500);
+    std::vector<int64_t> departures = drain.Run ({1500, 1500, 1500});
+    NS_TEST_ASSERT_MSG_EQ (departures.size (), 3u, "packets lost");
+    NS_TEST_ASSERT_MSG_EQ (departures[0], 0, "full bucket not used");
+    NS_TEST_ASSERT_MSG_EQ (departures[1], 12000, "wrong second departure");
+    NS_TEST_ASSERT_MSG_EQ (departures[2], 24000, "wrong third departure");
+  }
+  // a packet longer than the bucket waits for the missing tokens, the next
+  // one for its own length only (512 bits at 1 bit/ns)
+  {
+    P4QueueDrain drain (1);
+    drain.queue.set_rate_bps (0, 1000000000, 1500);
+    std::vector<int64_t> departures = drain.Run ({3000, 64});
+    NS_TEST_ASSERT_MSG_EQ (departures.size (), 2u, "packets lost");
+    NS_TEST_ASSERT_MSG_EQ (departures[0], 12000, "long packet did not wait");
+    NS_TEST_ASSERT_MSG_EQ (departures[1], 12512, "wrong departure after a long packet");
+  }
+  // a rate which is not a whole number of tokens per bit time: 3 Mb/s,
+  // 125 bytes (1000 bits) take 333333.3 ns, rounded up per packet
+  {
+    P4QueueDrain drain (1);
+    drain.queue.set_rate_bps (0, 3000000, 125);
+    std::vector<int64_t> departures = drain.Run ({125, 125, 125});
+    NS_TEST_ASSERT_MSG_EQ (departures[0], 0, "full bucket not used");
+    NS_TEST_ASSERT_MSG_EQ (departures[1], 333334, "wrong rounding");
+    NS_TEST_ASSERT_MSG_EQ (departures[2], 666667, "rounding drifts");
+  }
+  // set_rate() goes back to the packet rate, whatever the length
+  {
+    P4QueueDrain drain (1);
+    drain.queue.set_rate_bps (0, 1000000000, 1500);
+    drain.queue.set_rate (0, 1000000);
+    std::vector<int64_t> departures = drain.Run ({1500, 1500, 64});
+    NS_TEST_ASSERT_MSG_EQ (departures.size (), 3u, "packets lost");
+    // one packet time after the previous departure (the queue creation)
+    NS_TEST_ASSERT_MSG_EQ (departures[0], 1000, "wrong first departure");
+    NS_TEST_ASSERT_MSG_EQ (departures[1], 2000, "token bucket still used");
+    NS_TEST_ASSERT_MSG_EQ (departures[2], 3000, "token bucket still used");
+  }
+}
+
+// Packet i of a burst leaves i service times after the first one.
+class P4BurstTimingTestCase : public TestCase
+{
+public:
+  P4BurstTimingTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4BurstTimingTestCase::P4BurstTimingTestCase ()
+  : TestCase ("Check that the burst size does not change the departures")
+{
+}
+
+void
+P4BurstTimingTestCase::DoRun (void)
+{
+  // 16 packets which may all leave when the port starts at 1 us, 10 us of
+  // service each
+  std::vector<int64_t> departures[2];
+  const size_t bursts[2] = {1, 8};
+  for (int i = 0; i < 2; i++)
+    {
+      P4QueueDrain drain (1);
+      drain.queue.set_rate (0, 1000000000);
+      drain.burst = bursts[i];
+      drain.service = MicroSeconds (10);
+      departures[i] = drain.Run (std::vector<size_t> (16, 1500), MicroSeconds (1));
+    }
+  NS_TEST_ASSERT_MSG_EQ (departures[0].size (), 16u, "packets lost");
+  for (size_t i = 0; i < 16; i++)
+    {
+      NS_TEST_ASSERT_MSG_EQ (departures[0][i], int64_t (1000 + i * 10000),
+                             "wrong departure with one packet per burst");
+    }
+  NS_TEST_ASSERT_MSG_EQ ((departures[1] == departures[0]), true,
+                         "departures depend on the burst size");
+}
+
+// Pushes packets in logical queue 0 at t=0 and pops them at t=1 s, when
+// all of them may leave, so that only the scheduler decides the order.
+class P4QueueOrder
+{
+public:
+  explicit P4QueueOrder (size_t priorities)
+    : queue (1, 1024, P4TestWorkerMap (), priorities)
+  {
+    queue.set_rate_for_all (1000000000);
+  }
+
+  //! Returns the index of the packet, in push order.
+  int Push (size_t priority, size_t bytes, uint64_t rank = 0)
+  {
+    int item = bytes_.size ();
+    queue.push_front (0, priority, bytes, rank, int (item));
+    bytes_.push_back (bytes);
+    priority_.push_back (priority);
+    return item;
+  }
+
+  //! Pops up to \p count packets, in the order of the scheduler.
+  std::vector<int> Pop (size_t count = 1u << 20)
+  {
+    std::vector<int> popped;
+    while (popped.size () < count)
+      {
+        int item = -1;
+        size_t priority;
+        queue.pop_back_queue (0, &priority, &item);
+        if (item < 0)
+          {
+            break;
+          }
+        popped.push_back (item);
+      }
+    return popped;
+  }
+
+  //! Runs \p step at t=1 s, then \p next (if any) at t=2 s.
+  void Run (std::function<void (void)> step,
+            std::function<void (void)> next = std::function<void (void)> ())
+  {
+    m_steps.push_back (step);
+    Simulator::Schedule (Seconds (1), &P4QueueOrder::Step, this);
+    if (next)
+      {
+        m_steps.push_back (next);
+        Simulator::Schedule (Seconds (2), &P4QueueOrder::Step, this);
+      }
+    Simulator::Run ();
+    Simulator::Destroy ();
+  }
+
+  NSQueueingLogicPriRL<int, P4TestWorkerMap> queue;
+  std::vector<size_t> bytes_;
+  std::vector<size_t> priority_;
+
+private:
+  void Step (void)
+  {
+    m_steps.front () ();
+    m_steps.pop_front ();
+  }
+
+  std::deque<std::function<void (void)> > m_steps;
+};
+
+// The four schedulers of an egress port, and a change of scheduler while
+// the port drains.
+class P4EgressSchedulerTestCase : public TestCase
+{
+public:
+  P4EgressSchedulerTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+P4EgressSchedulerTestCase::P4EgressSchedulerTestCase ()
+  : TestCase ("Check the order of the egress schedulers")
+{
+}
+
+void
+P4EgressSchedulerTestCase::DoRun (void)
+{
+  std::vector<int> popped;
+
+  // strict priority: priority 0 first, FIFO within a priority
+  {
+    P4QueueOrder order (3);
+    for (int i = 0; i < 2; i++)
+      {
+        order.Push (2, 100);
+        order.Push (1, 100);
+        order.Push (0, 100);
+      }
+    order.Run ([&] () { popped = order.Pop (); });
+    NS_TEST_ASSERT_MSG_EQ ((popped == std::vector<int> {2, 5, 1, 4, 0, 3}), true,
+                           "wrong strict priority order");
+  }
+
+  // DRR: the bytes served while both queues are backlogged follow the
+  // weights (1:3), whatever the mix of 64 and 1500 byte packets
+  {
+    P4QueueOrder order (2);
+    order.queue.set_scheduler (0, SCHED_DRR);
+    order.queue.set_weight (0, 1, 3);
+    for (int i = 0; i < 160; i++)
+      {
+        order.Push (i % 4 == 0 ? 0 : 1, (i / 4) % 2 ? 64 : 1500);
+      }
+    order.Run ([&] () { popped = order.Pop (); });
+    NS_TEST_ASSERT_MSG_EQ (popped.size (), 160u, "packets lost");
+    uint64_t served[2] = {0, 0};
+    size_t left[2] = {40, 120};
+    for (int item : popped)
+      {
+        size_t priority = order.priority_[item];
+        served[priority] += order.bytes_[item];
+        if (--left[priority] == 0)
+          {
+            break;
+          }
+      }
+    // one quantum of each queue and one packet of difference at most
+    NS_TEST_ASSERT_MSG_LT (std::abs (int64_t (served[1]) - 3 * int64_t (served[0])),
+                           int64_t (3 * 1500 + 1500 + 3 * 1500), "DRR shares do not follow the weights");
+    NS_TEST_ASSERT_MSG_LT (uint64_t (10 * 1500), served[0], "DRR did not serve the light queue");
+  }
+
+  // WFQ: increasing finish tags, bytes / weight, ties by arrival
+  {
+    P4QueueOrder order (2);
+    order.queue.set_scheduler (0, SCHED_WFQ);
+    order.queue.set_weight (0, 1, 2);
+    for (int i = 0; i < 3; i++)
+      {
+        order.Push (0, 1000);  // tags 1000, 2000, 3000
+      }
+    for (int i = 0; i < 3; i++)
+      {
+        order.Push (1, 1000);  // tags 500, 1000, 1500
+      }
+    order.Run ([&] () { popped = order.Pop (); });
+    NS_TEST_ASSERT_MSG_EQ ((popped == std::vector<int> {3, 0, 4, 5, 1, 2}), true,
+                           "wrong WFQ finish tag order");
+  }
+
+  // PIFO: lowest rank first, equal ranks by arrival, across priorities
+  {
+    P4QueueOrder order (2);
+    order.queue.set_scheduler (0, SCHED_PIFO);
+    const uint64_t ranks[6] = {5, 1, 3, 1, 5, 0};
+    for (int i = 0; i < 6; i++)
+      {
+        order.Push (i % 2, 100, ranks[i]);
+      }
+    order.Run ([&] () { popped = order.Pop (); });
+    NS_TEST_ASSERT_MSG_EQ ((popped == std::vector<int> {5, 1, 3, 2, 0, 4}), true,
+                           "wrong PIFO order");
+  }
+
+  // a new scheduler waits until the queue has drained: the packets queued
+  // before, and those pushed meanwhile, keep the strict priority order.
+  // The last packets are popped once their shaping time has passed.
+  {
+    P4QueueOrder order (2);
+    std::vector<int> before, during, after;
+    order.Push (1, 100);
+    order.Push (0, 100);
+    order.Push (1, 100);
+    order.Push (0, 100);
+    order.Run ([&] () {
+      before = order.Pop (1);
+      order.queue.set_scheduler (0, SCHED_PIFO);
+      order.Push (1, 100, 0);
+      during = order.Pop ();
+      order.Push (0, 100, 7);
+      order.Push (1, 100, 2);
+    }, [&] () { after = order.Pop (); });
+    NS_TEST_ASSERT_MSG_EQ ((before == std::vector<int> {1}), true, "wrong first packet");
+    NS_TEST_ASSERT_MSG_EQ ((during == std::vector<int> {3, 0, 2, 4}), true,
+                           "scheduler changed before the queue drained");
+    NS_TEST_ASSERT_MSG_EQ ((after == std::vector<int> {6, 5}), true,
+                           "scheduler not changed once the queue drained");
+  }
+}
+
 // The TestSuite class names the TestSuite, identifies what type of TestSuite,
 // and enables the TestCases to be run.  Typically, only the constructor for
 // this class must be defined
@@ -58,6 +1008,21 @@ P4TestSuite::P4TestSuite ()
 {
   // TestDuration for TestCase can be QUICK, EXTENSIVE or TAKES_FOREVER
   AddTestCase (new P4TestCase1, TestCase::QUICK);
+  AddTestCase (new P4TimingWheelTestCase, TestCase::QUICK);
+  AddTestCase (new P4FifoRingTestCase, TestCase::QUICK);
+  AddTestCase (new P4PipelineTablesTestCase, TestCase::QUICK);
+  AddTestCase (new P4ObjectNamesTestCase, TestCase::QUICK);
+  AddTestCase (new P4TableStatisticsTestCase, TestCase::QUICK);
+  AddTestCase (new P4DeparserBytesTestCase, TestCase::QUICK);
+  AddTestCase (new P4ReadsPayloadTestCase, TestCase::QUICK);
+  AddTestCase (new P4PacketContextSlabTestCase, TestCase::QUICK);
+  AddTestCase (new P4LogHistogramTestCase, TestCase::QUICK);
+  AddTestCase (new P4StageProfilerTestCase, TestCase::QUICK);
+  AddTestCase (new P4AddressTableTestCase, TestCase::QUICK);
+  AddTestCase (new P4TraceSinkTestCase, TestCase::QUICK);
+  AddTestCase (new P4TokenBucketTestCase, TestCase::QUICK);
+  AddTestCase (new P4BurstTimingTestCase, TestCase::QUICK);
+  AddTestCase (new P4EgressSchedulerTestCase, TestCase::QUICK);
 }
 
 // Do not forget to allocate an instance of this TestSuite